@@ -0,0 +1,48 @@
+#ifndef RASPBERRY_BENCH_H
+#define RASPBERRY_BENCH_H
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#define BENCH_DB_FILE "bench_parkingspaces.db"
+
+/**
+ * Run the function a number of times and print the average time per call
+ * @return The average time per call, in nanoseconds
+ */
+inline double measure(const std::string &name, int iterations, const std::function<void(int)> &func) {
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++) {
+        func(i);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    double perCall = (double) elapsed.count() / iterations;
+
+    std::cout << name << ": " << iterations << " calls, " << perCall << " ns/call" << std::endl;
+
+    return perCall;
+}
+
+void runStatementCacheBench(int iterations);
+
+void runSnapshotBench(int spaces);
+
+void runFanOutBench(int iterations);
+
+void runSubscribersBench(int publishes);
+
+void runSSEBench(int updates);
+
+void runDecodeBench(int iterations);
+
+void runLotSnapshotBench(int iterations);
+
+void runPoolBench(int rounds);
+
+#endif //RASPBERRY_BENCH_H
@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "../database/SQLDatabase.h"
+#include <cstring>
+#include <cstdio>
+
+#define BENCH_SPACES 100
+
+#define BENCH_SELECT_SPACE "SELECT PID, SECTION, STATE, OCCUPANT_PLATE, LAST_CHANGE FROM SPACES WHERE PID=?"
+
+#define BENCH_UPDATE_SPACE "UPDATE SPACES SET STATE=?, OCCUPANT_PLATE=?, LAST_CHANGE=strftime('%s', 'now') WHERE PID=?"
+
+/**
+ * Compare the cost of preparing and finalizing a statement on every call (What SQLDatabase used to do)
+ * Against the statements kept in the StatementCache
+ */
+void runStatementCacheBench(int iterations) {
+
+    std::remove(BENCH_DB_FILE);
+
+    {
+        SQLDatabase database(BENCH_DB_FILE);
+
+        for (int i = 0; i < BENCH_SPACES; i++) {
+            database.insertSpace(i, "A");
+        }
+
+        measure("getStateForSpace (cached statement)", iterations, [&database](int i) {
+            database.getStateForSpace(i % BENCH_SPACES);
+        });
+
+        measure("updateSpaceState (cached statement)", iterations, [&database](int i) {
+            database.updateSpaceState(i % BENCH_SPACES,
+                                      (i & 1) ? parkingspaces::OCCUPIED : parkingspaces::FREE, std::string());
+        });
+    }
+
+    sqlite3 *db;
+
+    sqlite3_open(BENCH_DB_FILE, &db);
+
+    measure("getStateForSpace (prepare per call)", iterations, [db](int i) {
+        sqlite3_stmt *stmt;
+
+        sqlite3_prepare_v2(db, BENCH_SELECT_SPACE, strlen(BENCH_SELECT_SPACE), &stmt, nullptr);
+        sqlite3_bind_int(stmt, 1, i % BENCH_SPACES);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    });
+
+    measure("updateSpaceState (prepare per call)", iterations, [db](int i) {
+        sqlite3_stmt *stmt;
+
+        sqlite3_prepare_v2(db, BENCH_SELECT_SPACE, strlen(BENCH_SELECT_SPACE), &stmt, nullptr);
+        sqlite3_bind_int(stmt, 1, i % BENCH_SPACES);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+
+        sqlite3_prepare_v2(db, BENCH_UPDATE_SPACE, strlen(BENCH_UPDATE_SPACE), &stmt, nullptr);
+        sqlite3_bind_int(stmt, 1, (i & 1) ? parkingspaces::OCCUPIED : parkingspaces::FREE);
+        sqlite3_bind_null(stmt, 2);
+        sqlite3_bind_int(stmt, 3, i % BENCH_SPACES);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    });
+
+    sqlite3_close(db);
+
+    std::remove(BENCH_DB_FILE);
+}
+
+/**
+ * Apply a snapshot of the whole lot, one autocommit update per space against a single batch
+ */
+void runSnapshotBench(int spaces) {
+
+    std::remove(BENCH_DB_FILE);
+
+    SQLDatabase database(BENCH_DB_FILE);
+
+    std::vector<SpaceUpdate> updates;
+
+    for (int i = 0; i < spaces; i++) {
+        updates.push_back({static_cast<unsigned int>(i), parkingspaces::OCCUPIED, std::string(), "A"});
+    }
+
+    //Insert the spaces first, so both runs only update
+    database.applySpaceUpdates(updates);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const auto &update : updates) {
+        database.updateSpaceState(update.spaceID, parkingspaces::FREE, std::string());
+    }
+
+    auto autocommit = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    std::cout << "Snapshot of " << spaces << " spaces (autocommit per space): " << autocommit.count() << " ms" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+
+    database.applySpaceUpdates(updates);
+
+    auto batched = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    std::cout << "Snapshot of " << spaces << " spaces (single transaction): " << batched.count() << " ms" << std::endl;
+
+    std::remove(BENCH_DB_FILE);
+}
@@ -0,0 +1,60 @@
+#include "bench.h"
+#include "../conn_arduino/snapshot_decoder.h"
+
+#define DECODE_SPACES 10000
+
+/**
+ * Decode the initial snapshot of a synthetic 10k space lot, in both of the shapes Firebase sends it, by building the
+ * document and walking it (What the receiver used to do) against the streaming decoder
+ */
+void runDecodeBench(int iterations) {
+
+    std::string arrayData, objectData;
+
+    for (int space = 0; space < DECODE_SPACES; space++) {
+        std::string value = "{\"occupied\":" + std::string(space % 3 == 0 ? "true" : "false") + ",\"temp\":" +
+                            std::to_string(15 + space % 20) + ",\"reserved\":false}";
+
+        arrayData += (space > 0 ? "," : "") + value;
+        objectData += (space > 0 ? ",\"" : "\"") + std::to_string(space) + "\":" + value;
+    }
+
+    for (const auto &shape : {std::make_pair(std::string("array"), "{\"path\":\"/\",\"data\":[" + arrayData + "]}"),
+                              std::make_pair(std::string("object"), "{\"path\":\"/\",\"data\":{" + objectData + "}}")}) {
+
+        const std::string &event = shape.second;
+
+        std::cout << DECODE_SPACES << " spaces, " << shape.first << " snapshot (" << event.size() / 1024 << " KiB)"
+                  << std::endl;
+
+        size_t domReadings = 0, saxReadings = 0;
+
+        measure("  DOM parse and walk", iterations, [&event, &domReadings](int i) {
+            auto document = nlohmann::json::parse(event);
+
+            const auto &data = document["data"];
+
+            std::vector<SpaceReading> readings;
+
+            int index = 0;
+
+            for (auto it = data.begin(); it != data.end(); it++, index++) {
+                int spaceID = data.is_array() ? index : atoi(it.key().c_str());
+
+                readings.push_back({spaceID, (*it)["occupied"].get<bool>(), (*it)["temp"].get<int>()});
+            }
+
+            domReadings = readings.size();
+        });
+
+        measure("  streaming decode", iterations, [&event, &saxReadings](int i) {
+            SnapshotDecoder decoder;
+
+            nlohmann::json::sax_parse(event, &decoder);
+
+            saxReadings = decoder.getReadings().size();
+        });
+
+        std::cout << "  " << domReadings << " / " << saxReadings << " readings" << std::endl;
+    }
+}
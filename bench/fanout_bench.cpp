@@ -0,0 +1,39 @@
+#include "bench.h"
+#include "../server/parkingnotifications.h"
+
+/**
+ * The cost of publishing a single parking space update to a number of subscribers, serializing the update for every
+ * subscriber stream (What writing the message to each stream does) against serializing it once and sharing the buffer
+ */
+void runFanOutBench(int iterations) {
+
+    parkingspaces::ParkingSpaceStatus status;
+
+    status.set_spaceid(1234);
+    status.set_spacesection("SECTION-B");
+    status.set_spacestate(parkingspaces::OCCUPIED);
+
+    for (int subscribers : {1, 10, 100, 1000, 5000}) {
+
+        int publishes = std::max(1, iterations / subscribers);
+
+        std::cout << subscribers << " subscribers" << std::endl;
+
+        measure("  serialize per subscriber (per publish)", publishes, [&status, subscribers](int i) {
+            for (int sub = 0; sub < subscribers; sub++) {
+                grpc::ByteBuffer buffer;
+                bool own;
+
+                grpc::SerializationTraits<parkingspaces::ParkingSpaceStatus>::Serialize(status, &buffer, &own);
+            }
+        });
+
+        measure("  serialize once (per publish)", publishes, [&status, subscribers](int i) {
+            auto buffer = serializeMessage(status);
+
+            for (int sub = 0; sub < subscribers; sub++) {
+                grpc::ByteBuffer copy(buffer);
+            }
+        });
+    }
+}
@@ -0,0 +1,82 @@
+#include "bench.h"
+#include "../database/SQLDatabase.h"
+#include "../server/lotsnapshot.h"
+#include "../server/parkingnotifications.h"
+#include <cstdio>
+
+#define LOT_SPACES 2000
+
+/**
+ * Answer fetchAllParkingStates for a 2k space lot: loading and serializing every space for each call (What the
+ * handler used to do) against writing the cached snapshot, and against patching it after a change first
+ */
+void runLotSnapshotBench(int iterations) {
+
+    std::remove(BENCH_DB_FILE);
+
+    auto database = std::make_shared<SQLDatabase>(BENCH_DB_FILE);
+
+    std::vector<SpaceUpdate> updates;
+
+    for (int i = 0; i < LOT_SPACES; i++) {
+        updates.push_back({static_cast<unsigned int>(i), i % 3 == 0 ? parkingspaces::OCCUPIED : parkingspaces::FREE,
+                           std::string(), "A"});
+    }
+
+    database->applySpaceUpdates(updates);
+
+    size_t bytes = 0;
+
+    measure("Load and serialize the lot", iterations, [&database, &bytes](int i) {
+        auto spaceStates = database->fetchAllSpaceStates();
+
+        std::vector<parkingspaces::ParkingSpaceStatus> statuses;
+
+        statuses.reserve(spaceStates->size());
+
+        for (const auto &space : *spaceStates) {
+            parkingspaces::ParkingSpaceStatus status;
+
+            status.set_spaceid(space.getSpaceId());
+            status.set_spacesection(space.getSection());
+            status.set_spacestate(space.getState());
+
+            statuses.push_back(std::move(status));
+        }
+
+        for (const auto &status : statuses) {
+            bytes += serializeMessage(status).Length();
+        }
+    });
+
+    LotSnapshot snapshot(database);
+
+    //What a write does with each message
+    auto writeAll = [&bytes](const LotSnapshot::Messages &messages) {
+        for (const auto &message : messages) {
+            grpc::ByteBuffer copy(message);
+
+            bytes += copy.Length();
+        }
+    };
+
+    measure("Cached snapshot", iterations, [&snapshot, &writeAll](int i) {
+        writeAll(*snapshot.get());
+    });
+
+    measure("Patched snapshot (1 change per call)", iterations, [&snapshot, &writeAll](int i) {
+        parkingspaces::ParkingSpaceStatus status;
+
+        status.set_spaceid(i % LOT_SPACES);
+        status.set_spacesection("A");
+        status.set_spacestate(i % 2 == 0 ? parkingspaces::OCCUPIED : parkingspaces::FREE);
+
+        snapshot.update(status);
+
+        writeAll(*snapshot.get());
+    });
+
+    std::cout << "  " << bytes / iterations << " bytes per call" << std::endl;
+
+    std::remove(BENCH_DB_FILE);
+}
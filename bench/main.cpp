@@ -0,0 +1,49 @@
+#include "bench.h"
+#include <algorithm>
+#include <cstring>
+
+/**
+ * Microbenchmarks for the server hot paths
+ *
+ * Usage: RaspberryBench [benchmark] [iterations]
+ */
+int main(int argc, char **argv) {
+
+    std::string name = argc > 1 ? argv[1] : "all";
+
+    int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+
+    if (name == "all" || name == "statements") {
+        runStatementCacheBench(iterations);
+    }
+
+    if (name == "all" || name == "snapshot") {
+        runSnapshotBench(argc > 2 ? iterations : 5000);
+    }
+
+    if (name == "all" || name == "fanout") {
+        runFanOutBench(iterations * 10);
+    }
+
+    if (name == "all" || name == "subscribers") {
+        runSubscribersBench(iterations);
+    }
+
+    if (name == "all" || name == "sse") {
+        runSSEBench(iterations * 10);
+    }
+
+    if (name == "all" || name == "decode") {
+        runDecodeBench(std::max(1, iterations / 100));
+    }
+
+    if (name == "all" || name == "lot") {
+        runLotSnapshotBench(std::max(1, iterations / 100));
+    }
+
+    if (name == "all" || name == "pool") {
+        runPoolBench(std::max(1, iterations / 100));
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "../server/parkingnotifications.h"
+#include <list>
+
+#define POOL_BENCH_CALLS 1000
+
+#define POOL_BENCH_QUEUED 4
+
+/**
+ * A stream call as the allocator sees it: a server context and a queue that a few messages pile up in
+ */
+template<typename Queue>
+struct BenchCall {
+    grpc::ServerContext ctx;
+
+    Queue messageQueue;
+
+    void queueMessages() {
+        for (int i = 0; i < POOL_BENCH_QUEUED; i++) {
+            messageQueue.emplace_back(i, grpc::ByteBuffer());
+        }
+    }
+};
+
+struct HeapCall : BenchCall<std::list<std::pair<int, grpc::ByteBuffer>>> {
+};
+
+struct PooledCall : RPCContextBase,
+                    BenchCall<std::list<std::pair<int, grpc::ByteBuffer>,
+                            PoolAllocator<std::pair<int, grpc::ByteBuffer>>>> {
+    void Proceed(bool ok) override {}
+};
+
+template<typename Call>
+void reconnectStorm(int round) {
+
+    std::vector<Call *> calls;
+
+    calls.reserve(POOL_BENCH_CALLS);
+
+    for (int i = 0; i < POOL_BENCH_CALLS; i++) {
+        calls.push_back(new Call());
+
+        calls.back()->queueMessages();
+    }
+
+    for (auto call : calls) {
+        delete call;
+    }
+}
+
+/**
+ * Accept and free 1000 calls at once, with a few queued messages each, over and over (Clients reconnecting after a
+ * network blip) with the calls on the heap against the calls from the call pool
+ */
+void runPoolBench(int rounds) {
+
+    std::cout << POOL_BENCH_CALLS << " calls per round, " << POOL_BENCH_QUEUED << " queued messages each" << std::endl;
+
+    measure("  heap", rounds, reconnectStorm<HeapCall>);
+
+    auto before = CallPool::getStats();
+
+    measure("  call pool", rounds, reconnectStorm<PooledCall>);
+
+    auto after = CallPool::getStats();
+
+    std::cout << "  call pool: " << after.heapAllocations - before.heapAllocations << " heap allocations, "
+              << after.reused - before.reused << " reused blocks" << std::endl;
+}
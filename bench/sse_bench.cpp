@@ -0,0 +1,197 @@
+#include "bench.h"
+#include "../conn_arduino/sse_parser.h"
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+
+typedef std::vector<std::pair<std::string, std::string>> SSEEvents;
+
+/**
+ * Parse a stream cut in the given chunks, with a ring of the given size
+ */
+static SSEEvents parseInChunks(const std::string &stream, const std::vector<size_t> &chunks, size_t bufferSize) {
+
+    SSEEvents events;
+
+    SSEParser parser([&events](const std::string &event, const std::string &data) {
+        events.emplace_back(event, data);
+    }, bufferSize);
+
+    size_t position = 0;
+
+    for (size_t chunk : chunks) {
+        parser.feed(stream.data() + position, chunk);
+
+        position += chunk;
+    }
+
+    return events;
+}
+
+/**
+ * Replay random streams through the parser, whole and in random chunks, and check they give the events they were
+ * made of. The lines end in a mix of \n, \r\n and \r, the chunks are often a few bytes (So the line endings are split
+ * between them) and the ring starts tiny (So the lines wrap around its end and it has to grow).
+ *
+ * Exits with an error on the first stream that doesn't parse to its events
+ */
+static void verifySSEReplay(int streams) {
+
+    static const char *endings[] = {"\n", "\r\n", "\r"};
+
+    static const std::string alphabet = "abcdefghijklmnopqrstuvwxyz0123456789 :{}\",/";
+
+    std::mt19937 random(7);
+
+    long checked = 0;
+
+    for (int round = 0; round < streams; round++) {
+
+        std::string stream;
+
+        SSEEvents expected;
+
+        bool lastEndedInCR = false;
+
+        auto addLine = [&](const std::string &line) {
+            const char *ending = endings[random() % 3];
+
+            //A \n right after a \r is always read as part of a \r\n, so an empty line can't be sent that way
+            if (lastEndedInCR && line.empty() && ending[0] == '\n') ending = "\r\n";
+
+            stream += line;
+            stream += ending;
+
+            lastEndedInCR = ending[0] == '\r' && ending[1] == '\0';
+        };
+
+        auto randomText = [&](size_t maxLength) {
+            std::string text(random() % (maxLength + 1), ' ');
+
+            for (auto &c : text) c = alphabet[random() % alphabet.size()];
+
+            return text;
+        };
+
+        int events = 1 + random() % 20;
+
+        for (int i = 0; i < events; i++) {
+            if (random() % 4 == 0) addLine(":" + randomText(10));
+
+            std::string type = "message";
+
+            if (random() % 3 != 0) {
+                type = random() % 2 ? "put" : "patch";
+
+                addLine("event: " + type);
+            }
+
+            if (random() % 4 == 0) addLine("id: " + std::to_string(i));
+
+            std::string data;
+
+            int lines = 1 + random() % 3;
+
+            for (int line = 0; line < lines; line++) {
+                //Long lines now and then, so some outgrow the ring
+                std::string text = randomText(random() % 8 == 0 ? 300 : 40);
+
+                addLine("data: " + text);
+
+                data += (line > 0 ? "\n" : "") + text;
+            }
+
+            addLine("");
+
+            expected.emplace_back(type, data);
+        }
+
+        std::vector<size_t> chunks;
+
+        for (size_t position = 0; position < stream.size();) {
+            size_t chunk = std::min(stream.size() - position, (size_t) (1 + random() % (random() % 2 ? 4 : 64)));
+
+            chunks.push_back(chunk);
+
+            position += chunk;
+        }
+
+        bool whole = parseInChunks(stream, {stream.size()}, SSE_BUFFER_SIZE) == expected;
+        bool chunked = parseInChunks(stream, chunks, SSE_BUFFER_SIZE) == expected;
+        bool wrapped = parseInChunks(stream, chunks, 16) == expected;
+
+        if (!whole || !chunked || !wrapped) {
+            std::cerr << "SSE replay check failed on stream " << round << " (whole " << whole << ", chunked "
+                      << chunked << ", small ring " << wrapped << ")" << std::endl;
+
+            std::exit(EXIT_FAILURE);
+        }
+
+        checked += events;
+    }
+
+    std::cout << "SSE replay check: " << streams << " streams, " << checked << " events parsed the same whole and "
+              << "in chunks" << std::endl;
+}
+
+/**
+ * Check the parser on random streams, then replay a recorded-like Firebase event stream through it, cut in chunks of random sizes (Like the ones
+ * curl hands us), and report the parsing throughput. The stream starts with a large initial snapshot, which always
+ * spans many chunks, followed by small updates and keep-alives
+ */
+void runSSEBench(int updates) {
+
+    verifySSEReplay(500);
+
+    std::string stream = "event: put\ndata: {\"path\":\"/\",\"data\":{";
+
+    for (int space = 0; space < 10000; space++) {
+        stream += (space > 0 ? ",\"" : "\"") + std::to_string(space) + "\":{\"occupied\":false,\"temp\":21}";
+    }
+
+    stream += "}}\n\n";
+
+    for (int i = 0; i < updates; i++) {
+        if (i % 10 == 0) {
+            stream += "event: keep-alive\ndata: null\n\n";
+        } else {
+            stream += "event: put\ndata: {\"path\":\"/" + std::to_string(i % 10000) + "/occupied\",\"data\":true}\n\n";
+        }
+    }
+
+    std::mt19937 random(42);
+
+    std::vector<size_t> chunks;
+
+    for (size_t position = 0; position < stream.size();) {
+        size_t chunk = std::min(stream.size() - position, (size_t) (1 + random() % (16 * 1024)));
+
+        chunks.push_back(chunk);
+
+        position += chunk;
+    }
+
+    long events = 0, bytes = 0;
+
+    SSEParser parser([&events, &bytes](const std::string &event, const std::string &data) {
+        events++;
+        bytes += data.size();
+    });
+
+    double perReplay = measure("SSE replay (" + std::to_string(stream.size() / 1024) + " KiB, " +
+                               std::to_string(chunks.size()) + " chunks)", 20, [&](int i) {
+        parser.reset();
+
+        size_t position = 0;
+
+        for (size_t chunk : chunks) {
+            parser.feed(stream.data() + position, chunk);
+
+            position += chunk;
+        }
+    });
+
+    std::cout << "  " << events / 20 << " events per replay, "
+              << (double) stream.size() / (perReplay / 1e9) / (1024 * 1024) << " MiB/s" << std::endl;
+}
@@ -0,0 +1,151 @@
+#include "bench.h"
+#include "../server/parkingnotifications.h"
+#include <algorithm>
+#include <set>
+#include <thread>
+
+/**
+ * A subscriber that only counts what it receives
+ */
+class CountingSubscriber : public Writable<int> {
+
+public:
+    std::atomic_long received{0};
+
+    void Proceed(bool ok) override {}
+
+    bool isCancelled() const override { return false; }
+
+    bool shouldReceive(const int &) override { return true; }
+
+    void write(const int &) override { received++; }
+
+    void end() override {}
+};
+
+/**
+ * The subscriber list as it was before, a single lock held by publishers for the whole publish and by registrations
+ */
+class LockedSubscribers {
+
+    std::set<std::shared_ptr<Writable<int>>> subscribers;
+
+    std::mutex lock;
+
+public:
+    void registerSubscriber(const std::shared_ptr<Writable<int>> &sub) {
+        std::unique_lock<std::mutex> acqLock(lock);
+
+        subscribers.insert(sub);
+    }
+
+    void unregisterSubscriber(Writable<int> *sub) {
+        std::unique_lock<std::mutex> acqLock(lock);
+
+        for (auto it = subscribers.begin(); it != subscribers.end(); it++) {
+            if (it->get() == sub) {
+                subscribers.erase(it);
+                break;
+            }
+        }
+    }
+
+    void sendMessageToSubscribers(const int &message) {
+        std::unique_lock<std::mutex> acqLock(lock);
+
+        for (const auto &sub : subscribers) {
+            if (sub->shouldReceive(message)) sub->write(message);
+        }
+    }
+};
+
+/**
+ * Publish from a number of threads while other threads keep connecting and disconnecting subscribers, and report
+ * the publish latency
+ */
+template<typename List>
+void publishUnderChurn(const std::string &name, List &list, int publishes, int publishers, int churners) {
+
+    std::atomic_bool running{true};
+
+    std::vector<std::thread> churn;
+
+    for (int i = 0; i < churners; i++) {
+        churn.emplace_back([&list, &running]() {
+            while (running.load()) {
+                auto sub = std::make_shared<CountingSubscriber>();
+
+                list.registerSubscriber(sub);
+
+                list.unregisterSubscriber(sub.get());
+            }
+        });
+    }
+
+    std::vector<std::vector<long>> latencies(publishers);
+
+    std::vector<std::thread> publishing;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < publishers; i++) {
+        publishing.emplace_back([&list, &latencies, i, publishes]() {
+            for (int message = 0; message < publishes; message++) {
+                auto before = std::chrono::steady_clock::now();
+
+                list.sendMessageToSubscribers(message);
+
+                latencies[i].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - before).count());
+            }
+        });
+    }
+
+    for (auto &thread : publishing) thread.join();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    running.store(false);
+
+    for (auto &thread : churn) thread.join();
+
+    std::vector<long> all;
+
+    for (auto &thread : latencies) all.insert(all.end(), thread.begin(), thread.end());
+
+    std::sort(all.begin(), all.end());
+
+    std::cout << name << ": " << all.size() << " publishes in " << elapsed.count() << " ms, p50 "
+              << all[all.size() / 2] << " ns, p99 " << all[all.size() * 99 / 100] << " ns, max " << all.back()
+              << " ns" << std::endl;
+}
+
+/**
+ * Publishers against a constant connect/disconnect load, with the copy on write subscriber list against a list
+ * guarded by a single lock
+ */
+void runSubscribersBench(int publishes) {
+
+    for (int subscribers : {10, 100, 1000}) {
+
+        std::cout << subscribers << " subscribers, 4 publishers, 2 connecting threads" << std::endl;
+
+        std::vector<std::shared_ptr<CountingSubscriber>> connected;
+
+        Subscribers<int> copyOnWrite;
+
+        LockedSubscribers locked;
+
+        for (int i = 0; i < subscribers; i++) {
+            connected.push_back(std::make_shared<CountingSubscriber>());
+
+            copyOnWrite.registerSubscriber(connected.back());
+
+            locked.registerSubscriber(connected.back());
+        }
+
+        publishUnderChurn("  single lock", locked, publishes, 4, 2);
+
+        publishUnderChurn("  copy on write", copyOnWrite, publishes, 4, 2);
+    }
+}
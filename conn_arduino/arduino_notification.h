@@ -1,11 +1,29 @@
 #ifndef RASPBERRY_ARDUINO_NOTIFICATION_H
 #define RASPBERRY_ARDUINO_NOTIFICATION_H
 
+#include <climits>
 #include <memory>
 #include <utility>
+#include <vector>
 
 class ParkingServer;
 
+/**
+ * The temperature of readings that don't have one
+ */
+#define NO_TEMPERATURE INT_MIN
+
+/**
+ * The occupation of a space, as read by its sensor
+ */
+struct SpaceReading {
+    int spaceID;
+
+    bool occupied;
+
+    int temperature = NO_TEMPERATURE;
+};
+
 class ArduinoReceiver {
 
 protected:
@@ -16,6 +34,12 @@ public:
 
     virtual void receiveSpaceUpdate(int spaceID, bool occupied) = 0;
 
+    /**
+     * Receive the state of many spaces at once (For example the initial state of the whole lot)
+     * @param readings
+     */
+    virtual void receiveSpaceSnapshot(const std::vector<SpaceReading> &readings) = 0;
+
     virtual void receiveTemperatureUpdate(int spaceID, int temperature) = 0;
 };
 
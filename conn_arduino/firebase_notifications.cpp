@@ -1,5 +1,4 @@
 #include "firebase_notifications.h"
-#include <iostream>
 #include <list>
 #include <thread>
 #include <sstream>
@@ -7,7 +6,12 @@
 #include "curlpp/cURLpp.hpp"
 #include "curlpp/Easy.hpp"
 #include "curlpp/Options.hpp"
+#include "curlpp/Infos.hpp"
 #include "nlohmann/json.hpp"
+#include "snapshot_decoder.h"
+#include "sse_parser.h"
+#include "../log/logger.h"
+#include "../metrics/metrics.h"
 #include "../server/server.h"
 
 #define URL "https://parkingspaces-e0315-default-rtdb.europe-west1.firebasedatabase.app/"
@@ -21,15 +25,35 @@
 #define TEMPERATURE "temp"
 #define RESERVED "reserved"
 
+#define PUT_EVENT "put"
+#define PATCH_EVENT "patch"
+#define KEEP_ALIVE_EVENT "keep-alive"
+
 static ArduinoReceiver *receiver = nullptr;
 
+static Counter &flagsQueued = Metrics::instance().counter("parking_firebase_notifications_total",
+                                                          "The reserved flags queued to be sent to Firebase");
+
+static Counter &flagsSent = Metrics::instance().counter("parking_firebase_flags_sent_total",
+                                                        "The reserved flags sent to Firebase, in any number of PATCHes");
+
+static Counter &patchFailures = Metrics::instance().counter("parking_firebase_patch_failures_total",
+                                                            "The PATCHes Firebase failed or rejected");
+
+static Histogram &patchLatency = Metrics::instance().histogram("parking_firebase_patch_seconds",
+                                                               "The time of the PATCHes of the reserved flags");
+
 using namespace nlohmann;
 using namespace curlpp::options;
 
+void parsePathAndData(const std::string &path, const json &data);
+
 void parseArray(const json &array) {
 
     int current = 0;
 
+    std::vector<SpaceReading> readings;
+
     for (auto it = array.begin(); it != array.end(); it++) {
 
         if (*it != nullptr) {
@@ -38,10 +62,10 @@ void parseArray(const json &array) {
 
             if (occupied.is_boolean()) {
 
-                receiver->receiveSpaceUpdate(current, occupied.get<bool>());
+                readings.push_back({current, occupied.get<bool>()});
 
             } else {
-                std::cout << occupied.type_name() << std::endl;
+                LOG_WARN("Unexpected occupied value", {"space", current}, {"type", occupied.type_name()});
             }
 
             if (it->contains(TEMPERATURE)) {
@@ -55,21 +79,34 @@ void parseArray(const json &array) {
 
         current++;
     }
+
+    receiver->receiveSpaceSnapshot(readings);
 }
 
 void parseObj(const json &obj) {
 
+    std::vector<SpaceReading> readings;
+
     for (auto it = obj.begin(); it != obj.end(); it++) {
 
         const std::string &key = it.key();
 
         const json &value = it.value();
 
+        if (key.find('/') != std::string::npos) {
+            //A multi-path patch (Like the ones we send with the reserved flags), every key is a path under the root
+            parsePathAndData("/" + key, value);
+
+            continue;
+        }
+
+        if (!value.is_object()) continue;
+
         int spaceID = atoi(key.c_str());
 
         bool occupied = value[OCCUPIED];
 
-        receiver->receiveSpaceUpdate(spaceID, occupied);
+        readings.push_back({spaceID, occupied});
 
         if (value.contains(TEMPERATURE)) {
             int temp = value[TEMPERATURE];
@@ -78,6 +115,7 @@ void parseObj(const json &obj) {
         }
     }
 
+    receiver->receiveSpaceSnapshot(readings);
 }
 
 void parsePathAndData(const std::string &path, const json &data) {
@@ -129,13 +167,28 @@ void parsePathAndData(const std::string &path, const json &data) {
 
 void parseData(const std::string &string) {
 
-    size_t sz = string.find_first_of(':');
+    //The snapshot of the whole lot is decoded as it's parsed, without building the document
+    SnapshotDecoder decoder;
+
+    bool decoded = json::sax_parse(string, &decoder);
 
-    std::string finalStr = string.substr(sz + 1);
+    if (decoder.isSnapshot()) {
+        if (decoded) {
+            if (!decoder.getReadings().empty()) {
+                receiver->receiveSpaceSnapshot(decoder.getReadings());
+            }
 
-    std::cout << finalStr << std::endl;
+            for (const auto &reading : decoder.getTemperatures()) {
+                receiver->receiveTemperatureUpdate(reading.spaceID, reading.temperature);
+            }
+        }
 
-    json json_obj = json::parse(finalStr);
+        return;
+    }
+
+    LOG_DEBUG("Received event data", {"data", string});
+
+    json json_obj = json::parse(string);
 
     std::string path = json_obj[PATH];
 
@@ -158,32 +211,36 @@ void parseData(const std::string &string) {
 
 }
 
-/// Callback must be declared static, otherwise it won't link...
-size_t WriteCallback(char *ptr, size_t size, size_t nmemb) {
-
-    std::string rqString(ptr);
+void handleEvent(const std::string &event, const std::string &data) {
 
-    std::istringstream strStream(rqString);
+    if (event == PUT_EVENT || event == PATCH_EVENT) {
+        try {
+            parseData(data);
+        } catch (json::exception &e) {
+            LOG_WARN("Failed to parse the event", {"event", event}, {"error", e.what()});
+        }
+    } else if (event != KEEP_ALIVE_EVENT) {
+        //cancel or auth_revoked, the stream is closed by Firebase and we reconnect
+        LOG_INFO("Received event", {"event", event}, {"data", data});
+    }
+}
 
-    std::string split;
+/**
+ * The events can be split over any number of chunks, so the parser keeps what it has read between them
+ */
+static SSEParser streamParser(handleEvent);
 
-    while (getline(strStream, split, '\n')) {
-        if (split == "event: keep-alive") {
-            return size * nmemb;
-        } else if (split.rfind("data: ", 0) == 0) {
-            //This is the data we want to read
+/// Callback must be declared static, otherwise it won't link...
+size_t WriteCallback(char *ptr, size_t size, size_t nmemb) {
 
-            parseData(split);
-            break;
-        }
-    }
+    streamParser.feed(ptr, size * nmemb);
 
     return size * nmemb;
 };
 
 void subscribeToData() {
 
-    std::cout << "subscribing..." << std::endl;
+    LOG_INFO("Subscribing to Firebase");
 
     try {
 
@@ -191,6 +248,8 @@ void subscribeToData() {
 
         curlpp::Easy request;
 
+        streamParser.reset();
+
         request.setOpt<Url>(std::string(URL) + SPACES + JSON);
 
         std::list<std::string> list;
@@ -206,46 +265,172 @@ void subscribeToData() {
         //When we reach here, it means that the request ended.
     }
     catch (curlpp::LogicError &e) {
-        std::cout << e.what() << std::endl;
+        LOG_ERROR("Firebase subscription failed", {"error", e.what()});
     }
     catch (curlpp::RuntimeError &e) {
-        std::cout << e.what() << std::endl;
+        LOG_ERROR("Firebase subscription failed", {"error", e.what()});
     }
 
-    std::cout << "Request ended, retrying..." << std::endl;
+    LOG_INFO("Firebase subscription ended, retrying");
 
     subscribeToData();
 }
 
+FirebaseReceiver::FirebaseReceiver(std::shared_ptr<ParkingServer> server, int debounceMs) :
+        ArduinoReceiver(std::move(server)),
+        debouncer([this](int spaceID, bool occupied) {
+            this->server->receiveParkingSpaceNotification(spaceID, occupied);
+        }, debounceMs) {
+    subscribe();
+}
+
 void FirebaseReceiver::subscribe() {
     receiver = this;
     this->notificationThread = std::thread(subscribeToData);
 }
 
 void FirebaseReceiver::receiveSpaceUpdate(int spaceID, bool occupied) {
-    this->server->receiveParkingSpaceNotification(spaceID, occupied);
+    this->debouncer.receiveSpaceUpdate(spaceID, occupied);
+}
+
+void FirebaseReceiver::receiveSpaceSnapshot(const std::vector<SpaceReading> &readings) {
+    //The snapshot is the state of the lot as it is, it replaces whatever changes were being held back
+    this->debouncer.settle(readings, [this, &readings]() {
+        this->server->receiveParkingSpaceSnapshot(readings);
+    });
 }
 
 void FirebaseReceiver::receiveTemperatureUpdate(int spaceID, int temperature) {
     this->server->receiveTemperatureUpdate(spaceID, temperature);
 }
 
-FirebaseNotifications::FirebaseNotifications() {}
+FirebaseNotifications::FirebaseNotifications() {
+    this->senderThread.start([this](std::unique_lock<std::mutex> &waitLock) { sendLoop(waitLock); });
+
+    Metrics::instance().observe("parking_firebase_pending_flags", "The reserved flags waiting to be sent",
+                                MetricType::GAUGE, [this]() {
+                                    auto acqLock = this->senderThread.acquire();
+
+                                    return (double) this->pending.size();
+                                }, this);
+}
+
+FirebaseNotifications::~FirebaseNotifications() {
+
+    Metrics::instance().removeObserved(this);
+
+    this->senderThread.stop();
+}
 
 void FirebaseNotifications::notifyArduino(int spaceID, bool reserved) {
 
+    {
+        auto acqLock = this->senderThread.acquire();
+
+        this->pending[spaceID] = reserved;
+    }
+
+    flagsQueued.increment();
+
+    this->senderThread.wakeOne();
+}
+
+void FirebaseNotifications::sendLoop(std::unique_lock<std::mutex> &waitLock) {
+
     curlpp::Cleanup cleaner;
-    curlpp::Easy rq;
 
-    rq.setOpt(Url(std::string(URL) + SPACES + "/" + std::to_string(spaceID) + JSON));
+    //The same handle is used for every request, so the connection (And its TLS session) is kept between them
+    curlpp::Easy request;
+
+    request.setOpt(Url(std::string(URL) + SPACES + JSON));
+    request.setOpt(CustomRequest{"PATCH"});
+    request.setOpt(TcpKeepAlive(1));
+    request.setOpt(NoSignal(true));
+    request.setOpt(Timeout(FIREBASE_TIMEOUT_S));
+
+    //Firebase answers with the values that were written, which we don't need
+    request.setOpt(WriteFunction([](char *ptr, size_t size, size_t nmemb) { return size * nmemb; }));
+
+    while (true) {
+
+        this->senderThread.waitForWork(waitLock, [this]() { return !this->pending.empty(); });
+
+        if (this->pending.empty()) break;
+
+        //Give the updates that follow this one the chance to go out with it
+        this->senderThread.sleep(waitLock, std::chrono::milliseconds(FIREBASE_BATCH_WINDOW_MS));
+
+        std::map<int, bool> updates;
+
+        updates.swap(this->pending);
+
+        waitLock.unlock();
+
+        for (auto it = updates.begin(); it != updates.end();) {
+            auto known = this->sent.find(it->first);
+
+            //The space flipped back to what Firebase already has
+            if (known != this->sent.end() && known->second == it->second) {
+                it = updates.erase(it);
+            } else {
+                it++;
+            }
+        }
+
+        bool result = updates.empty() || sendUpdates(request, updates);
+
+        waitLock.lock();
+
+        if (result) {
+            for (const auto &update : updates) {
+                this->sent[update.first] = update.second;
+            }
+        } else if (this->senderThread.isRunning()) {
+            //Keep the failed updates, unless the spaces have changed again in the meantime
+            this->pending.insert(updates.begin(), updates.end());
+
+            this->senderThread.sleep(waitLock, std::chrono::milliseconds(FIREBASE_RETRY_MS));
+        }
+    }
+}
+
+bool FirebaseNotifications::sendUpdates(curlpp::Easy &request, const std::map<int, bool> &updates) {
+
+    json body = json::object();
+
+    for (const auto &update : updates) {
+        body[std::to_string(update.first) + "/" + RESERVED] = update.second;
+    }
+
+    ScopedTimer timer(patchLatency);
+
+    try {
+        request.setOpt(PostFields(body.dump()));
+
+        request.perform();
+
+        long code = curlpp::infos::ResponseCode::get(request);
 
-    json spaceObj = json::object();
+        if (code != 200) {
+            LOG_WARN("Firebase rejected the updates", {"updates", updates.size()}, {"code", code});
+
+            patchFailures.increment();
+
+            return false;
+        }
 
-    spaceObj[RESERVED] = reserved;
+        flagsSent.increment(updates.size());
 
-    rq.setOpt(PostFields(spaceObj.dump()));
+        return true;
+    }
+    catch (curlpp::LogicError &e) {
+        LOG_ERROR("Failed to send the updates to Firebase", {"updates", updates.size()}, {"error", e.what()});
+    }
+    catch (curlpp::RuntimeError &e) {
+        LOG_ERROR("Failed to send the updates to Firebase", {"updates", updates.size()}, {"error", e.what()});
+    }
 
-    rq.setOpt(CustomRequest{"PATCH"});
+    patchFailures.increment();
 
-    rq.perform();
+    return false;
 }
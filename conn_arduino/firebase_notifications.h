@@ -2,34 +2,98 @@
 #define RASPBERRY_FIREBASE_NOTIFICATIONS_H
 
 #include "arduino_notification.h"
+#include "sensor_debouncer.h"
+#include "curlpp/Easy.hpp"
+#include "../util/backgroundloop.h"
+#include <map>
 #include <thread>
 
 
 class FirebaseReceiver : public ArduinoReceiver {
 
 private:
+    /**
+     * The occupation changes go through it before reaching the server
+     */
+    SensorDebouncer debouncer;
+
     std::thread notificationThread;
 
 public:
-    explicit FirebaseReceiver(std::shared_ptr<ParkingServer> server) : ArduinoReceiver(std::move(server)) {
-        subscribe();
+    /**
+     * @param debounceMs How long an occupation change has to last before it reaches the server, 0 to forward them all
+     */
+    explicit FirebaseReceiver(std::shared_ptr<ParkingServer> server, int debounceMs = DEFAULT_DEBOUNCE_MS);
+
+    const SensorDebouncer &getDebouncer() const {
+        return debouncer;
     }
 
     void receiveSpaceUpdate(int spaceID, bool occupied) override;
 
+    void receiveSpaceSnapshot(const std::vector<SpaceReading> &readings) override;
+
     void receiveTemperatureUpdate(int spaceID, int temperature) override;
 
 private:
     void subscribe();
 };
 
+/**
+ * How long the sender waits after an update before sending it, so the updates that come right after it
+ * (And flips of the same space) go out in the same PATCH
+ */
+#define FIREBASE_BATCH_WINDOW_MS 50
+
+/**
+ * How long the sender waits before retrying after a failed PATCH
+ */
+#define FIREBASE_RETRY_MS 1000
+
+#define FIREBASE_TIMEOUT_S 10
+
+/**
+ * Sends the reserved flags of the spaces to Firebase from a dedicated thread, over a connection that is kept open.
+ *
+ * Only the latest flag of each space is kept until it's sent, and all the pending spaces are sent in a single
+ * multi-path PATCH of spaces.json, so a space that is reserved and unreserved in a row costs at most one write.
+ */
 class FirebaseNotifications : public ArduinoConnection {
 
+private:
+    /**
+     * The latest reserved flag of every space that still has to be sent
+     */
+    std::map<int, bool> pending;
+
+    /**
+     * The flags Firebase already has, only used by the sender thread
+     */
+    std::map<int, bool> sent;
+
+    BackgroundLoop senderThread;
+
 public:
     FirebaseNotifications();
 
+    /**
+     * Sends the updates that are still pending before returning
+     */
+    ~FirebaseNotifications();
+
+    /**
+     * Queue the reserved flag of a space to be sent, this never blocks on the network
+     */
     void notifyArduino(int spaceID, bool reserved) override;
 
+private:
+    void sendLoop(std::unique_lock<std::mutex> &waitLock);
+
+    /**
+     * Send the flags of many spaces in one PATCH
+     * @return Whether Firebase accepted them
+     */
+    bool sendUpdates(curlpp::Easy &request, const std::map<int, bool> &updates);
 };
 
 
@@ -0,0 +1,156 @@
+#include "sensor_debouncer.h"
+#include "../metrics/metrics.h"
+
+SensorDebouncer::SensorDebouncer(Forward forward, int thresholdMs) : forward(std::move(forward)),
+                                                                     threshold(thresholdMs),
+                                                                     suppressed(0),
+                                                                     forwarded(0) {
+    this->timerThread.start([this](std::unique_lock<std::mutex> &waitLock) { timerLoop(waitLock); });
+
+    Metrics::instance().observe("parking_sensor_reports_suppressed_total",
+                                "The sensor reports that were held back and flipped back before the threshold",
+                                MetricType::COUNTER, [this]() { return (double) getSuppressedEvents(); }, this);
+
+    Metrics::instance().observe("parking_sensor_reports_forwarded_total",
+                                "The sensor reports that were forwarded to the server", MetricType::COUNTER,
+                                [this]() { return (double) getForwardedEvents(); }, this);
+}
+
+SensorDebouncer::~SensorDebouncer() {
+
+    Metrics::instance().removeObserved(this);
+
+    this->timerThread.stop();
+}
+
+void SensorDebouncer::receiveSpaceUpdate(int spaceID, bool occupied) {
+
+    if (this->threshold.count() <= 0) {
+        this->forwarded++;
+
+        this->forward(spaceID, occupied);
+
+        return;
+    }
+
+    {
+        auto acqLock = this->timerThread.acquire();
+
+        auto &space = this->spaces[spaceID];
+
+        if (space.pending && space.candidate == occupied) {
+            //A repeat of the change that is being held back, its timer keeps running
+            this->suppressed++;
+
+            return;
+        }
+
+        if (space.pending) {
+            //The held back change flipped back before the threshold
+            space.pending = false;
+
+            this->suppressed++;
+        }
+
+        if (space.known && space.stable == occupied) {
+            this->suppressed++;
+
+            return;
+        }
+
+        space.pending = true;
+        space.candidate = occupied;
+        space.generation++;
+
+        this->deadlines.push_back({Clock::now() + this->threshold, spaceID, space.generation});
+    }
+
+    this->timerThread.wakeOne();
+}
+
+void SensorDebouncer::settle(const std::vector<SpaceReading> &readings, const std::function<void()> &apply) {
+
+    std::unique_lock<std::mutex> forwardingLock(this->forwardLock);
+
+    {
+        auto acqLock = this->timerThread.acquire();
+
+        for (const auto &reading : readings) {
+            auto &space = this->spaces[reading.spaceID];
+
+            space.known = true;
+            space.stable = reading.occupied;
+            space.pending = false;
+            space.settled++;
+        }
+    }
+
+    apply();
+}
+
+void SensorDebouncer::timerLoop(std::unique_lock<std::mutex> &waitLock) {
+
+    std::vector<Due> due;
+
+    while (this->timerThread.isRunning()) {
+
+        if (this->deadlines.empty()) {
+            this->timerThread.wait(waitLock);
+
+            continue;
+        }
+
+        auto now = Clock::now();
+
+        if (this->deadlines.front().time > now) {
+            this->timerThread.waitUntil(waitLock, this->deadlines.front().time);
+
+            continue;
+        }
+
+        while (!this->deadlines.empty() && this->deadlines.front().time <= now) {
+            auto deadline = this->deadlines.front();
+
+            this->deadlines.pop_front();
+
+            auto &space = this->spaces[deadline.spaceID];
+
+            //Changes that were dropped or replaced since have their own timer, or none
+            if (!space.pending || space.generation != deadline.generation) continue;
+
+            space.pending = false;
+            space.known = true;
+            space.stable = space.candidate;
+
+            due.push_back({deadline.spaceID, space.stable, space.settled});
+        }
+
+        waitLock.unlock();
+
+        {
+            std::unique_lock<std::mutex> forwardingLock(this->forwardLock);
+
+            for (const auto &change : due) {
+
+                {
+                    auto acqLock = this->timerThread.acquire();
+
+                    //A snapshot came in between, it already has the state of the space
+                    if (this->spaces[change.spaceID].settled != change.settled) {
+                        this->suppressed++;
+
+                        continue;
+                    }
+                }
+
+                this->forwarded++;
+
+                this->forward(change.spaceID, change.occupied);
+            }
+        }
+
+        due.clear();
+
+        waitLock.lock();
+    }
+}
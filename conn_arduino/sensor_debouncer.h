@@ -0,0 +1,124 @@
+#ifndef RASPBERRY_SENSOR_DEBOUNCER_H
+#define RASPBERRY_SENSOR_DEBOUNCER_H
+
+#include "arduino_notification.h"
+#include "../util/backgroundloop.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * How long the occupation of a space has to stay the same before it's forwarded, in milliseconds
+ */
+#define DEFAULT_DEBOUNCE_MS 1500
+
+/**
+ * Holds back the occupation changes reported by the sensors until they have lasted for a threshold, so the jitter of
+ * a sensor (A car driving past, a reading flipping back and forth) never reaches the server.
+ *
+ * A change is only forwarded once it has lasted for the whole threshold, every other report (Repeats, and changes
+ * that flipped back before the threshold) is suppressed and counted.
+ */
+class SensorDebouncer {
+
+public:
+    typedef std::function<void(int spaceID, bool occupied)> Forward;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct SpaceDebounce {
+        /**
+         * The last occupation that was forwarded, if any
+         */
+        bool known = false, stable = false;
+
+        /**
+         * The change that is being held back
+         */
+        bool pending = false, candidate = false;
+
+        /**
+         * Bumped with every new candidate, so the timers of the older ones are ignored
+         */
+        unsigned generation = 0;
+
+        /**
+         * Bumped by every snapshot, a change that was due before the snapshot is older than it
+         */
+        unsigned settled = 0;
+    };
+
+    struct Deadline {
+        Clock::time_point time;
+
+        int spaceID;
+
+        unsigned generation;
+    };
+
+    struct Due {
+        int spaceID;
+
+        bool occupied;
+
+        unsigned settled;
+    };
+
+    Forward forward;
+
+    std::chrono::milliseconds threshold;
+
+    std::unordered_map<int, SpaceDebounce> spaces;
+
+    /**
+     * The threshold is the same for every change, so the deadlines are always added in order
+     */
+    std::deque<Deadline> deadlines;
+
+    std::atomic_long suppressed, forwarded;
+
+    /**
+     * Held while the due changes are forwarded and while a snapshot is settled and applied, so a change is never
+     * forwarded after a snapshot that replaced it. Always taken before the lock of the timer thread
+     */
+    std::mutex forwardLock;
+
+    BackgroundLoop timerThread;
+
+public:
+    SensorDebouncer(Forward forward, int thresholdMs = DEFAULT_DEBOUNCE_MS);
+
+    ~SensorDebouncer();
+
+    /**
+     * Receive a report of a sensor, it's forwarded if it still holds after the threshold
+     */
+    void receiveSpaceUpdate(int spaceID, bool occupied);
+
+    /**
+     * Take the state of many spaces as they are, without holding them back (For example the initial snapshot of the
+     * lot). Changes that were being held back for these spaces are dropped, or were already forwarded before
+     * @param apply Applies the snapshot, no change is forwarded while it runs
+     */
+    void settle(const std::vector<SpaceReading> &readings, const std::function<void()> &apply);
+
+    /**
+     * The number of reports that were not forwarded
+     */
+    long getSuppressedEvents() const {
+        return suppressed.load();
+    }
+
+    long getForwardedEvents() const {
+        return forwarded.load();
+    }
+
+private:
+    void timerLoop(std::unique_lock<std::mutex> &waitLock);
+};
+
+#endif //RASPBERRY_SENSOR_DEBOUNCER_H
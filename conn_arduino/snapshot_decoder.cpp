@@ -0,0 +1,243 @@
+#include "snapshot_decoder.h"
+#include <cstdlib>
+#include "../log/logger.h"
+
+#define ROOT_PATH "/"
+
+#define PATH_KEY "path"
+#define DATA_KEY "data"
+#define OCCUPIED_FIELD "occupied"
+#define TEMPERATURE_FIELD "temp"
+
+/*
+ * The levels of the event: the event object is at depth 1, the spaces at depth 2 and their fields at depth 3
+ */
+#define EVENT_DEPTH 1
+#define SPACE_DEPTH 2
+#define FIELD_DEPTH 3
+
+SnapshotDecoder::SnapshotDecoder() : depth(0),
+                                     shape(NO_DATA),
+                                     snapshot(false),
+                                     current({0, false}),
+                                     inSpace(false),
+                                     hasOccupation(false),
+                                     hasTemperature(false),
+                                     index(0) {}
+
+bool SnapshotDecoder::startData() {
+
+    if (path != ROOT_PATH) {
+        //Not the snapshot, or a path that comes after the data. Either way it's left to the DOM parser
+        snapshot = false;
+
+        return false;
+    }
+
+    snapshot = true;
+
+    return true;
+}
+
+void SnapshotDecoder::beginSpace(int spaceID) {
+    current = {spaceID, false};
+
+    inSpace = true;
+    hasOccupation = false;
+    hasTemperature = false;
+}
+
+void SnapshotDecoder::endSpace() {
+
+    if (hasOccupation) {
+        readings.push_back(current);
+    } else if (hasTemperature) {
+        temperatures.push_back(current);
+    }
+
+    inSpace = false;
+}
+
+void SnapshotDecoder::value(bool isBoolean, bool boolValue, bool isInteger, long long intValue) {
+
+    if (depth == FIELD_DEPTH && inSpace) {
+        if (isBoolean && field == OCCUPIED_FIELD) {
+            current.occupied = boolValue;
+
+            hasOccupation = true;
+        } else if (isInteger && field == TEMPERATURE_FIELD) {
+            current.temperature = (int) intValue;
+
+            hasTemperature = true;
+        }
+    } else if (depth == SPACE_DEPTH) {
+
+        if (shape == ARRAY_DATA) {
+            //A missing space
+            index++;
+
+            return;
+        }
+
+        //A multi-path patch, the key is <space>/<field>
+        size_t separator = spaceKey.find('/');
+
+        if (separator == std::string::npos) return;
+
+        beginSpace(atoi(spaceKey.c_str()));
+
+        field = spaceKey.substr(separator + 1);
+
+        depth = FIELD_DEPTH;
+
+        value(isBoolean, boolValue, isInteger, intValue);
+
+        depth = SPACE_DEPTH;
+
+        endSpace();
+    }
+}
+
+bool SnapshotDecoder::null() {
+
+    if (depth == EVENT_DEPTH && topKey == DATA_KEY) return startData();
+
+    value(false, false, false, 0);
+
+    return true;
+}
+
+bool SnapshotDecoder::boolean(bool val) {
+
+    if (depth == EVENT_DEPTH && topKey == DATA_KEY) return startData();
+
+    value(true, val, false, 0);
+
+    return true;
+}
+
+bool SnapshotDecoder::number_integer(number_integer_t val) {
+
+    if (depth == EVENT_DEPTH && topKey == DATA_KEY) return startData();
+
+    value(false, false, true, val);
+
+    return true;
+}
+
+bool SnapshotDecoder::number_unsigned(number_unsigned_t val) {
+
+    if (depth == EVENT_DEPTH && topKey == DATA_KEY) return startData();
+
+    value(false, false, true, (long long) val);
+
+    return true;
+}
+
+bool SnapshotDecoder::number_float(number_float_t val, const string_t &s) {
+
+    if (depth == EVENT_DEPTH && topKey == DATA_KEY) return startData();
+
+    value(false, false, false, 0);
+
+    return true;
+}
+
+bool SnapshotDecoder::string(string_t &val) {
+
+    if (depth == EVENT_DEPTH) {
+        if (topKey == PATH_KEY) {
+            path = val;
+        } else if (topKey == DATA_KEY) {
+            return startData();
+        }
+
+        return true;
+    }
+
+    value(false, false, false, 0);
+
+    return true;
+}
+
+#if NLOHMANN_JSON_VERSION_MAJOR > 3 || (NLOHMANN_JSON_VERSION_MAJOR == 3 && NLOHMANN_JSON_VERSION_MINOR >= 8)
+
+bool SnapshotDecoder::binary(binary_t &val) {
+
+    value(false, false, false, 0);
+
+    return true;
+}
+
+#endif
+
+bool SnapshotDecoder::start_object(std::size_t elements) {
+    return startContainer(false);
+}
+
+bool SnapshotDecoder::start_array(std::size_t elements) {
+    return startContainer(true);
+}
+
+bool SnapshotDecoder::startContainer(bool array) {
+
+    if (depth == EVENT_DEPTH && topKey == DATA_KEY) {
+        if (!startData()) return false;
+
+        shape = array ? ARRAY_DATA : OBJECT_DATA;
+
+        index = 0;
+    } else if (depth == SPACE_DEPTH && !array) {
+        if (shape == ARRAY_DATA) {
+            beginSpace(index);
+        } else if (spaceKey.find('/') == std::string::npos) {
+            beginSpace(atoi(spaceKey.c_str()));
+        }
+    }
+
+    depth++;
+
+    return true;
+}
+
+bool SnapshotDecoder::key(string_t &val) {
+
+    if (depth == EVENT_DEPTH) {
+        topKey = val;
+    } else if (depth == SPACE_DEPTH) {
+        spaceKey = val;
+    } else if (depth == FIELD_DEPTH) {
+        field = val;
+    }
+
+    return true;
+}
+
+bool SnapshotDecoder::end_object() {
+    return endContainer();
+}
+
+bool SnapshotDecoder::end_array() {
+    return endContainer();
+}
+
+bool SnapshotDecoder::endContainer() {
+
+    depth--;
+
+    if (depth == SPACE_DEPTH) {
+        if (inSpace) endSpace();
+
+        if (shape == ARRAY_DATA) index++;
+    }
+
+    return true;
+}
+
+bool SnapshotDecoder::parse_error(std::size_t position, const std::string &last_token,
+                                  const nlohmann::detail::exception &ex) {
+
+    LOG_WARN("Failed to decode the snapshot", {"position", position}, {"error", ex.what()});
+
+    return false;
+}
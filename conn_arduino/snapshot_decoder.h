@@ -0,0 +1,124 @@
+#ifndef RASPBERRY_SNAPSHOT_DECODER_H
+#define RASPBERRY_SNAPSHOT_DECODER_H
+
+#include "arduino_notification.h"
+#include "nlohmann/json.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Decodes the initial snapshot of the lot (The put event on the root path) as it's parsed, without building the
+ * document: every space is turned into a SpaceReading the moment its object ends.
+ *
+ * The data can either be an array indexed by the space ID (With nulls for the missing spaces) or an object keyed by
+ * the space ID. Keys with a path in them ("3/occupied") are multi-path patches and are decoded as such.
+ *
+ * Events on any other path are left to the DOM parser, they are a few bytes long. So the decoder gives up
+ * (And isSnapshot() is false) as soon as it sees the data of an event that isn't on the root path.
+ */
+class SnapshotDecoder : public nlohmann::json_sax<nlohmann::json> {
+
+private:
+    enum DataShape {
+        NO_DATA, ARRAY_DATA, OBJECT_DATA
+    };
+
+    std::vector<SpaceReading> readings;
+
+    /**
+     * The spaces with a temperature but no occupation
+     */
+    std::vector<SpaceReading> temperatures;
+
+    int depth;
+
+    std::string topKey, path, field, spaceKey;
+
+    DataShape shape;
+
+    bool snapshot;
+
+    /**
+     * The space being decoded, and whether it had any field we use
+     */
+    SpaceReading current;
+
+    bool inSpace, hasOccupation, hasTemperature;
+
+    /**
+     * The index of the next element when the data is an array
+     */
+    int index;
+
+public:
+    SnapshotDecoder();
+
+    bool isSnapshot() const {
+        return snapshot;
+    }
+
+    const std::vector<SpaceReading> &getReadings() const {
+        return readings;
+    }
+
+    const std::vector<SpaceReading> &getTemperatures() const {
+        return temperatures;
+    }
+
+    bool null() override;
+
+    bool boolean(bool val) override;
+
+    bool number_integer(number_integer_t val) override;
+
+    bool number_unsigned(number_unsigned_t val) override;
+
+    bool number_float(number_float_t val, const string_t &s) override;
+
+    bool string(string_t &val) override;
+
+#if NLOHMANN_JSON_VERSION_MAJOR > 3 || (NLOHMANN_JSON_VERSION_MAJOR == 3 && NLOHMANN_JSON_VERSION_MINOR >= 8)
+
+    /**
+     * Only part of the SAX interface from 3.8 onwards, the JSON the build fetches is older
+     */
+    bool binary(binary_t &val) override;
+
+#endif
+
+    bool start_object(std::size_t elements) override;
+
+    bool key(string_t &val) override;
+
+    bool end_object() override;
+
+    bool start_array(std::size_t elements) override;
+
+    bool end_array() override;
+
+    bool parse_error(std::size_t position, const std::string &last_token,
+                     const nlohmann::detail::exception &ex) override;
+
+private:
+    /**
+     * Called when the data of the event starts
+     * @return Whether it's the snapshot, the decoder stops when it's not
+     */
+    bool startData();
+
+    bool startContainer(bool array);
+
+    bool endContainer();
+
+    void beginSpace(int spaceID);
+
+    void endSpace();
+
+    /**
+     * A value inside the data, either a field of a space, a missing space of an array or a multi-path patch
+     */
+    void value(bool isBoolean, bool boolValue, bool isInteger, long long intValue);
+};
+
+#endif //RASPBERRY_SNAPSHOT_DECODER_H
@@ -0,0 +1,168 @@
+#include "sse_parser.h"
+#include <algorithm>
+#include <cstring>
+
+#define DEFAULT_EVENT_TYPE "message"
+
+SSEParser::SSEParser(EventHandler handler, size_t bufferSize) : handler(std::move(handler)),
+                                                                ring(bufferSize),
+                                                                head(0),
+                                                                scanned(0),
+                                                                tail(0),
+                                                                hasData(false),
+                                                                skipLineFeed(false) {}
+
+void SSEParser::feed(const char *chunk, size_t length) {
+
+    if (tail - head + length > ring.size()) {
+        grow(tail - head + length);
+    }
+
+    size_t position = tail & mask();
+
+    size_t untilEnd = std::min(length, ring.size() - position);
+
+    memcpy(&ring[position], chunk, untilEnd);
+    memcpy(&ring[0], chunk + untilEnd, length - untilEnd);
+
+    tail += length;
+
+    consumeLines();
+}
+
+void SSEParser::reset() {
+    head = scanned = tail = 0;
+
+    eventType.clear();
+    data.clear();
+
+    hasData = false;
+    skipLineFeed = false;
+}
+
+void SSEParser::grow(size_t needed) {
+
+    size_t size = ring.size();
+
+    while (size < needed) size *= 2;
+
+    std::vector<char> bigger(size);
+
+    //Unwrap the bytes that haven't been consumed yet to the start of the new buffer
+    for (size_t position = head; position < tail; position++) {
+        bigger[position - head] = ring[position & mask()];
+    }
+
+    scanned -= head;
+    tail -= head;
+    head = 0;
+
+    ring.swap(bigger);
+}
+
+void SSEParser::consumeLines() {
+
+    while (scanned < tail) {
+
+        if (skipLineFeed) {
+            skipLineFeed = false;
+
+            //The \n of a \r\n line ending that was split between chunks
+            if (ring[scanned & mask()] == '\n') {
+                head = ++scanned;
+
+                continue;
+            }
+        }
+
+        size_t position = scanned & mask();
+
+        const char *start = &ring[position];
+        const char *end = start + std::min(tail - scanned, ring.size() - position);
+
+        const char *lineEnd = std::find_if(start, end, [](char c) { return c == '\n' || c == '\r'; });
+
+        scanned += lineEnd - start;
+
+        if (lineEnd == end) {
+            //Either the line isn't complete yet or it continues at the start of the ring
+            continue;
+        }
+
+        size_t length = scanned - head;
+
+        size_t lineStart = head & mask();
+
+        if (lineStart + length <= ring.size()) {
+            handleLine(&ring[lineStart], length);
+        } else {
+            size_t untilEnd = ring.size() - lineStart;
+
+            wrappedLine.assign(&ring[lineStart], untilEnd);
+            wrappedLine.append(&ring[0], length - untilEnd);
+
+            handleLine(wrappedLine.data(), length);
+        }
+
+        if (*lineEnd == '\r') {
+            //Either \r or \r\n
+            skipLineFeed = true;
+        }
+
+        head = ++scanned;
+    }
+}
+
+void SSEParser::handleLine(const char *line, size_t length) {
+
+    if (length == 0) {
+        //An empty line ends the event
+        dispatch();
+
+        return;
+    }
+
+    if (line[0] == ':') {
+        //A comment
+        return;
+    }
+
+    auto colon = (const char *) memchr(line, ':', length);
+
+    size_t fieldLength = colon == nullptr ? length : colon - line;
+
+    const char *value = colon == nullptr ? line + length : colon + 1;
+
+    size_t valueLength = line + length - value;
+
+    if (valueLength > 0 && *value == ' ') {
+        value++;
+        valueLength--;
+    }
+
+    if (fieldLength == 5 && memcmp(line, "event", 5) == 0) {
+        eventType.assign(value, valueLength);
+    } else if (fieldLength == 4 && memcmp(line, "data", 4) == 0) {
+        if (hasData) data.push_back('\n');
+
+        data.append(value, valueLength);
+
+        hasData = true;
+    }
+
+    //The id and retry fields are not used by Firebase
+}
+
+void SSEParser::dispatch() {
+
+    static const std::string defaultType(DEFAULT_EVENT_TYPE);
+
+    if (hasData) {
+        handler(eventType.empty() ? defaultType : eventType, data);
+    }
+
+    eventType.clear();
+    data.clear();
+
+    hasData = false;
+}
@@ -0,0 +1,84 @@
+#ifndef RASPBERRY_SSE_PARSER_H
+#define RASPBERRY_SSE_PARSER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * The initial size of the buffer, in bytes (Must be a power of 2). It grows when an event doesn't fit
+ */
+#define SSE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * Incremental parser of a Server-Sent Events stream.
+ *
+ * The chunks are appended to a ring buffer as they arrive, in whatever size the connection hands them to us, and
+ * every complete line is consumed from it in place. So events can span any number of chunks and a chunk can
+ * hold any number of events. The buffer, the event type and the data are reused between events, so a stream in
+ * its steady state doesn't allocate.
+ */
+class SSEParser {
+
+public:
+    /**
+     * Called for every complete event with its type ("message" when it has none) and its data
+     */
+    typedef std::function<void(const std::string &event, const std::string &data)> EventHandler;
+
+private:
+    EventHandler handler;
+
+    std::vector<char> ring;
+
+    /**
+     * Positions in the stream (Not wrapped around the ring): where the first unconsumed byte is, up to where the
+     * buffer has been searched for the end of the line and where the next byte is written
+     */
+    size_t head, scanned, tail;
+
+    /**
+     * The fields of the event that is being read
+     */
+    std::string eventType, data;
+
+    bool hasData;
+
+    /**
+     * A line that wraps around the end of the ring is copied here
+     */
+    std::string wrappedLine;
+
+    /**
+     * Whether the last line ended with a \r, which means a \n right after it is part of the same line ending
+     */
+    bool skipLineFeed;
+
+public:
+    explicit SSEParser(EventHandler handler, size_t bufferSize = SSE_BUFFER_SIZE);
+
+    /**
+     * Parse the next chunk of the stream, the handler is called for every event it completes
+     */
+    void feed(const char *chunk, size_t length);
+
+    /**
+     * Forget any partial event, for when the stream is reconnected
+     */
+    void reset();
+
+private:
+    size_t mask() const {
+        return ring.size() - 1;
+    }
+
+    void grow(size_t needed);
+
+    void consumeLines();
+
+    void handleLine(const char *line, size_t length);
+
+    void dispatch();
+};
+
+#endif //RASPBERRY_SSE_PARSER_H
@@ -0,0 +1,394 @@
+#include "MemoryDatabase.h"
+#include "../log/logger.h"
+#include <ctime>
+
+using namespace parkingspaces;
+
+MemoryDatabase::MemoryDatabase(std::shared_ptr<SQLDatabase> backing) : backing(std::move(backing)),
+                                                                       spaces(),
+                                                                       plates(),
+                                                                       dirtySpaces() {
+    loadSpaces();
+
+    this->flushThread.start([this](std::unique_lock<std::mutex> &waitLock) { flushLoop(waitLock); });
+}
+
+MemoryDatabase::~MemoryDatabase() {
+
+    this->flushThread.stop();
+
+    //Write whatever changed since the last flush
+    flush();
+}
+
+void MemoryDatabase::loadSpaces() {
+
+    auto states = this->backing->fetchAllSpaceStates();
+
+    for (const auto &state : *states) {
+
+        if (state.getSpaceId() < 0 || state.getSpaceId() > MAX_SPACE_ID) {
+            LOG_WARN("Ignoring space with invalid ID", {"space", state.getSpaceId()});
+
+            continue;
+        }
+
+        if ((size_t) state.getSpaceId() >= this->spaces.size()) {
+            this->spaces.resize(state.getSpaceId() + 1);
+        }
+
+        SpaceRow &row = this->spaces[state.getSpaceId()];
+
+        row.present = true;
+        row.state = state.getState();
+        row.section = state.getSection();
+        row.occupant = state.getOccupant();
+        row.lastChange = state.getLastChange();
+
+        if (!row.occupant.empty()) {
+            this->plates[row.occupant] = state.getSpaceId();
+        }
+    }
+
+    LOG_INFO("Loaded spaces into memory", {"spaces", states->size()});
+}
+
+void MemoryDatabase::flushLoop(std::unique_lock<std::mutex> &waitLock) {
+
+    while (this->flushThread.sleep(waitLock, std::chrono::milliseconds(FLUSH_INTERVAL_MS))) {
+
+        waitLock.unlock();
+
+        flush();
+
+        waitLock.lock();
+    }
+}
+
+void MemoryDatabase::flush() {
+
+    std::vector<SpaceState> toPersist;
+
+    {
+        std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+        if (this->dirtySpaces.empty()) return;
+
+        toPersist.reserve(this->dirtySpaces.size());
+
+        for (auto spaceID : this->dirtySpaces) {
+            SpaceRow &row = this->spaces[spaceID];
+
+            row.dirty = false;
+
+            toPersist.push_back(toSpaceState(spaceID, row));
+        }
+
+        this->dirtySpaces.clear();
+    }
+
+    //The SQL write happens outside of the lock, so readers and writers never wait for the disk
+    if (!this->backing->persistSpaces(toPersist)) {
+
+        LOG_WARN("Failed to flush spaces, retrying on the next flush", {"spaces", toPersist.size()});
+
+        std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+        for (const auto &space : toPersist) {
+            markDirty(space.getSpaceId(), this->spaces[space.getSpaceId()]);
+        }
+    }
+}
+
+SpaceState MemoryDatabase::toSpaceState(unsigned int spaceID, const MemoryDatabase::SpaceRow &row) {
+    return SpaceState(spaceID, row.state, row.section, row.occupant, row.lastChange);
+}
+
+MemoryDatabase::SpaceRow *MemoryDatabase::findSpace(unsigned int spaceID) {
+
+    if (spaceID >= this->spaces.size() || !this->spaces[spaceID].present) {
+        return nullptr;
+    }
+
+    return &this->spaces[spaceID];
+}
+
+bool MemoryDatabase::setOccupant(unsigned int spaceID, MemoryDatabase::SpaceRow &row, const std::string &licensePlate) {
+
+    if (!licensePlate.empty()) {
+        auto owner = this->plates.find(licensePlate);
+
+        if (owner != this->plates.end() && owner->second != spaceID) {
+            //Same as the UNIQUE(OCCUPANT_PLATE) constraint on the SQL table
+            return false;
+        }
+    }
+
+    if (!row.occupant.empty()) {
+        this->plates.erase(row.occupant);
+    }
+
+    row.occupant = licensePlate;
+
+    if (!licensePlate.empty()) {
+        this->plates[licensePlate] = spaceID;
+    }
+
+    return true;
+}
+
+void MemoryDatabase::markDirty(unsigned int spaceID, MemoryDatabase::SpaceRow &row) {
+
+    if (!row.dirty) {
+        row.dirty = true;
+
+        this->dirtySpaces.push_back(spaceID);
+    }
+}
+
+MemoryDatabase::SpaceRow *MemoryDatabase::createSpace(unsigned int spaceID, const std::string &section) {
+
+    if (spaceID > MAX_SPACE_ID) {
+        LOG_ERROR("Space ID is too large", {"space", spaceID});
+
+        return nullptr;
+    }
+
+    if (spaceID >= this->spaces.size()) {
+        this->spaces.resize(spaceID + 1);
+    }
+
+    SpaceRow &row = this->spaces[spaceID];
+
+    if (row.present) {
+        LOG_ERROR("Space already exists", {"space", spaceID});
+
+        return nullptr;
+    }
+
+    row.present = true;
+    row.state = SpaceStates::FREE;
+    row.section = section;
+    row.occupant.clear();
+    row.lastChange = time(nullptr);
+
+    markDirty(spaceID, row);
+
+    return &row;
+}
+
+void MemoryDatabase::insertSpace(unsigned int spaceID, const std::string &section) {
+
+    std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+    createSpace(spaceID, section);
+}
+
+void MemoryDatabase::writeSpaceState(unsigned int spaceID, MemoryDatabase::SpaceRow &row, SpaceStates state,
+                                     const std::string &licensePlate) {
+
+    if (!setOccupant(spaceID, row, licensePlate)) {
+        LOG_ERROR("Plate is already in another space", {"space", spaceID}, {"plate", licensePlate});
+
+        return;
+    }
+
+    row.state = state;
+    row.lastChange = time(nullptr);
+
+    markDirty(spaceID, row);
+}
+
+std::vector<SpaceState> MemoryDatabase::applySpaceUpdates(const std::vector<SpaceUpdate> &updates) {
+
+    std::vector<SpaceState> prevStates;
+
+    prevStates.reserve(updates.size());
+
+    std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+    for (const auto &update : updates) {
+
+        auto row = findSpace(update.spaceID);
+
+        if (row == nullptr) {
+            row = createSpace(update.spaceID, update.section);
+
+            if (row == nullptr) {
+                prevStates.emplace_back(update.spaceID, SpaceStates::FREE, update.section, std::string());
+
+                continue;
+            }
+        }
+
+        prevStates.push_back(toSpaceState(update.spaceID, *row));
+
+        writeSpaceState(update.spaceID, *row, update.state, update.licensePlate);
+    }
+
+    return prevStates;
+}
+
+std::unique_ptr<std::vector<SpaceState>> MemoryDatabase::fetchAllSpaceStates() {
+
+    std::shared_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto states = std::make_unique<std::vector<SpaceState>>();
+
+    for (unsigned int spaceID = 0; spaceID < this->spaces.size(); spaceID++) {
+        if (this->spaces[spaceID].present) {
+            states->push_back(toSpaceState(spaceID, this->spaces[spaceID]));
+        }
+    }
+
+    return states;
+}
+
+std::optional<SpaceState> MemoryDatabase::getStateForSpace(unsigned int spaceID) {
+
+    std::shared_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto row = findSpace(spaceID);
+
+    if (row == nullptr) return std::nullopt;
+
+    return toSpaceState(spaceID, *row);
+}
+
+std::unique_ptr<std::vector<SpaceState>> MemoryDatabase::getExpiredReserveStates() {
+
+    int64_t expiredBefore = time(nullptr) - RESERVATION_EXPIRATION * 60;
+
+    std::shared_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto states = std::make_unique<std::vector<SpaceState>>();
+
+    for (unsigned int spaceID = 0; spaceID < this->spaces.size(); spaceID++) {
+        const SpaceRow &row = this->spaces[spaceID];
+
+        if (row.present && row.state == SpaceStates::RESERVED && row.lastChange <= expiredBefore) {
+            states->push_back(toSpaceState(spaceID, row));
+        }
+    }
+
+    return states;
+}
+
+std::optional<SpaceState>
+MemoryDatabase::updateSpaceState(unsigned int spaceID, parkingspaces::SpaceStates state, const std::string &licensePlate) {
+
+    std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto row = findSpace(spaceID);
+
+    if (row == nullptr) return std::nullopt;
+
+    auto prevState = toSpaceState(spaceID, *row);
+
+    writeSpaceState(spaceID, *row, state, licensePlate);
+
+    return prevState;
+}
+
+bool MemoryDatabase::updateSpacePlate(unsigned int spaceID, const std::string &licensePlate) {
+
+    std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto row = findSpace(spaceID);
+
+    if (row == nullptr) return true;
+
+    if (!setOccupant(spaceID, *row, licensePlate)) {
+        return false;
+    }
+
+    markDirty(spaceID, *row);
+
+    return true;
+}
+
+std::optional<SpaceState> MemoryDatabase::findSpaceWithPlate(const std::string &licensePlate, SpaceStates state) {
+
+    std::shared_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto space = this->plates.find(licensePlate);
+
+    if (space == this->plates.end()) return std::nullopt;
+
+    const SpaceRow &row = this->spaces[space->second];
+
+    if (row.state != state) return std::nullopt;
+
+    return toSpaceState(space->second, row);
+}
+
+std::optional<SpaceState> MemoryDatabase::getReservationForLicensePlate(const std::string &licensePlate) {
+    return findSpaceWithPlate(licensePlate, SpaceStates::RESERVED);
+}
+
+std::optional<SpaceState> MemoryDatabase::getSpaceOccupiedByLicensePlate(const std::string &licensePlate) {
+    return findSpaceWithPlate(licensePlate, SpaceStates::OCCUPIED);
+}
+
+bool MemoryDatabase::attemptToReserveSpot(unsigned int spaceID, const std::string &licensePlate) {
+
+    std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto row = findSpace(spaceID);
+
+    if (row == nullptr || row->state != SpaceStates::FREE) return false;
+
+    if (!setOccupant(spaceID, *row, licensePlate)) {
+        //The license plate already has a reservation (or is parked)
+        return false;
+    }
+
+    row->state = SpaceStates::RESERVED;
+    row->lastChange = time(nullptr);
+
+    markDirty(spaceID, *row);
+
+    return true;
+}
+
+bool MemoryDatabase::cancelReservationsFor(const std::string &licensePlate) {
+
+    std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto space = this->plates.find(licensePlate);
+
+    if (space == this->plates.end()) return false;
+
+    unsigned int spaceID = space->second;
+
+    SpaceRow &row = this->spaces[spaceID];
+
+    if (row.state != SpaceStates::RESERVED) return false;
+
+    setOccupant(spaceID, row, std::string());
+
+    row.state = SpaceStates::FREE;
+    row.lastChange = time(nullptr);
+
+    markDirty(spaceID, row);
+
+    return true;
+}
+
+bool MemoryDatabase::cancelReservationForSpot(int spaceID) {
+
+    if (spaceID < 0) return false;
+
+    std::unique_lock<std::shared_mutex> acqLock(this->lock);
+
+    auto row = findSpace(spaceID);
+
+    if (row == nullptr || row->state != SpaceStates::RESERVED) return false;
+
+    row->state = SpaceStates::FREE;
+    row->lastChange = time(nullptr);
+
+    markDirty(spaceID, *row);
+
+    return true;
+}
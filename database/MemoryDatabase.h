@@ -0,0 +1,135 @@
+#ifndef RASPBERRY_MEMORYDATABASE_H
+#define RASPBERRY_MEMORYDATABASE_H
+
+#include "database.h"
+#include "SQLDatabase.h"
+#include "../util/backgroundloop.h"
+#include <shared_mutex>
+#include <unordered_map>
+
+/**
+ * How often the dirty spaces are written to the SQL database, in milliseconds.
+ * This is the most we can lose if the process crashes
+ */
+#define FLUSH_INTERVAL_MS 1000
+
+/**
+ * The highest space ID we accept, as the spaces are stored in an array indexed by their ID
+ */
+#define MAX_SPACE_ID 65535
+
+/**
+ * A database that keeps the state of every space in memory and is the authority on it.
+ *
+ * All reads are answered from memory, changes are marked dirty and written to the SQL database
+ * In batches by a background thread (Write behind), every FLUSH_INTERVAL_MS.
+ */
+class MemoryDatabase : public Database {
+
+private:
+    struct SpaceRow {
+        bool present = false, dirty = false;
+
+        parkingspaces::SpaceStates state = parkingspaces::SpaceStates::FREE;
+
+        std::string section, occupant;
+
+        int64_t lastChange = 0;
+    };
+
+    std::shared_ptr<SQLDatabase> backing;
+
+    /**
+     * The spaces, indexed by their space ID
+     */
+    std::vector<SpaceRow> spaces;
+
+    /**
+     * The space each license plate is in, as a plate can only be in a single space
+     */
+    std::unordered_map<std::string, unsigned int> plates;
+
+    /**
+     * The spaces that have changed since the last flush
+     */
+    std::vector<unsigned int> dirtySpaces;
+
+    std::shared_mutex lock;
+
+    BackgroundLoop flushThread;
+
+public:
+    explicit MemoryDatabase(std::shared_ptr<SQLDatabase> backing);
+
+    ~MemoryDatabase();
+
+private:
+    void loadSpaces();
+
+    void flushLoop(std::unique_lock<std::mutex> &waitLock);
+
+    /**
+     * Write the dirty spaces to the SQL database
+     */
+    void flush();
+
+    /**
+     * Get the row for a space, the lock must already be held
+     * @return nullptr if the space does not exist
+     */
+    SpaceRow *findSpace(unsigned int spaceID);
+
+    /**
+     * Change the occupant of a space, keeping the plate index up to date. The unique lock must already be held
+     * @return false if the plate is already in another space
+     */
+    bool setOccupant(unsigned int spaceID, SpaceRow &row, const std::string &licensePlate);
+
+    /**
+     * Mark a space as changed, the unique lock must already be held
+     */
+    void markDirty(unsigned int spaceID, SpaceRow &row);
+
+    /**
+     * Insert a space, the unique lock must already be held
+     * @return nullptr if the ID is not valid or the space already exists
+     */
+    SpaceRow *createSpace(unsigned int spaceID, const std::string &section);
+
+    /**
+     * Change the state and occupant of an existing space, the unique lock must already be held
+     */
+    void writeSpaceState(unsigned int spaceID, SpaceRow &row, parkingspaces::SpaceStates state,
+                         const std::string &licensePlate);
+
+    std::optional<SpaceState> findSpaceWithPlate(const std::string &licensePlate, parkingspaces::SpaceStates state);
+
+    static SpaceState toSpaceState(unsigned int spaceID, const SpaceRow &row);
+
+public:
+    void insertSpace(unsigned int spaceID, const std::string &section) override;
+
+    std::unique_ptr<std::vector<SpaceState>> fetchAllSpaceStates() override;
+
+    std::optional<SpaceState> getStateForSpace(unsigned int spaceID) override;
+
+    std::unique_ptr<std::vector<SpaceState>> getExpiredReserveStates() override;
+
+    std::optional<SpaceState> updateSpaceState(unsigned int spaceID, parkingspaces::SpaceStates state, const std::string &licensePlate) override;
+
+    bool updateSpacePlate(unsigned int spaceID, const std::string &licensePlate) override;
+
+    std::vector<SpaceState> applySpaceUpdates(const std::vector<SpaceUpdate> &updates) override;
+
+    std::optional<SpaceState> getReservationForLicensePlate(const std::string &licensePlate) override;
+
+    std::optional<SpaceState> getSpaceOccupiedByLicensePlate(const std::string &licensePlate) override;
+
+    bool attemptToReserveSpot(unsigned int spaceID, const std::string &licensePlate) override;
+
+    bool cancelReservationsFor(const std::string &licensePlate) override;
+
+    bool cancelReservationForSpot(int spaceID) override;
+};
+
+#endif //RASPBERRY_MEMORYDATABASE_H
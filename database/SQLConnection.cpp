@@ -0,0 +1,96 @@
+#include "SQLConnection.h"
+#include "../log/logger.h"
+
+SQLConnection::SQLConnection(const std::string &fileName, bool readOnly, const SQLProfile &profile) : db(nullptr) {
+
+    int flags = readOnly ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+
+    int result = sqlite3_open_v2(fileName.c_str(), &this->db, flags, nullptr);
+
+    if (result != SQLITE_OK) {
+
+        LOG_ERROR("Failed to open database", {"error", sqlite3_errmsg(this->db)});
+
+        exit(EXIT_FAILURE);
+    }
+
+    sqlite3_busy_timeout(this->db, profile.busyTimeoutMs);
+
+    applyProfile(readOnly, profile);
+}
+
+SQLConnection::~SQLConnection() {
+
+    //Finalize the statements before closing, or the connection stays open
+    this->statements.reset();
+
+    sqlite3_close(this->db);
+}
+
+void SQLConnection::prepareStatements(const char *const *sql, size_t count) {
+    this->statements = std::make_unique<StatementCache>(this->db, sql, count);
+}
+
+void SQLConnection::applyProfile(bool readOnly, const SQLProfile &profile) {
+
+    std::string pragmas;
+
+    if (!readOnly) {
+        //The journal mode is stored in the database, so only the writer sets it
+        pragmas += "PRAGMA journal_mode=" + profile.journalMode + ";"
+                   "PRAGMA synchronous=" + profile.synchronous + ";";
+
+        if (profile.usesWAL() && profile.checkpointIntervalSeconds > 0) {
+            //The checkpointer takes care of the log, so the writes never stop to checkpoint it
+            pragmas += "PRAGMA wal_autocheckpoint=0;";
+        }
+    }
+
+    pragmas += "PRAGMA mmap_size=" + std::to_string(profile.mmapSize) + ";"
+               //Negative sizes are in KiB instead of pages
+               "PRAGMA cache_size=-" + std::to_string(profile.cacheSizeKb) + ";"
+               "PRAGMA temp_store=" + profile.tempStore + ";";
+
+    char *errMsg = nullptr;
+
+    int rs = sqlite3_exec(this->db, pragmas.c_str(), nullptr, nullptr, &errMsg);
+
+    if (rs != SQLITE_OK) {
+        LOG_ERROR("Failed to apply the database profile", {"error", errMsg});
+
+        sqlite3_free(errMsg);
+    }
+}
+
+void ConnectionPool::add(std::unique_ptr<SQLConnection> connection) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    this->idle.push_back(connection.get());
+
+    this->connections.push_back(std::move(connection));
+}
+
+ConnectionPool::Lease ConnectionPool::acquire() {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    this->available.wait(acqLock, [this]() { return !this->idle.empty(); });
+
+    SQLConnection *connection = this->idle.back();
+
+    this->idle.pop_back();
+
+    return Lease(this, connection);
+}
+
+void ConnectionPool::release(SQLConnection *connection) {
+
+    {
+        std::unique_lock<std::mutex> acqLock(this->lock);
+
+        this->idle.push_back(connection);
+    }
+
+    this->available.notify_one();
+}
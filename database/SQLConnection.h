@@ -0,0 +1,137 @@
+#ifndef RASPBERRY_SQLCONNECTION_H
+#define RASPBERRY_SQLCONNECTION_H
+
+#include "StatementCache.h"
+#include "SQLProfile.h"
+#include <sqlite3.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * A connection to the database together with the statements prepared on it.
+ *
+ * Like its StatementCache, a connection must only be used by one thread at a time.
+ */
+class SQLConnection {
+
+private:
+    sqlite3 *db;
+
+    std::unique_ptr<StatementCache> statements;
+
+public:
+    /**
+     * Open a connection and apply the profile to it
+     * @param fileName
+     * @param readOnly Read only connections do not change the journal mode of the database
+     * @param profile
+     */
+    SQLConnection(const std::string &fileName, bool readOnly, const SQLProfile &profile);
+
+    SQLConnection(const SQLConnection &) = delete;
+
+    SQLConnection &operator=(const SQLConnection &) = delete;
+
+    ~SQLConnection();
+
+    /**
+     * Prepare the statements of this connection, must be called (once) before get
+     */
+    void prepareStatements(const char *const *sql, size_t count);
+
+    ScopedStatement get(size_t index) const {
+        return this->statements->get(index);
+    }
+
+    sqlite3 *handle() const {
+        return db;
+    }
+
+    int changes() const {
+        return sqlite3_changes(db);
+    }
+
+    const char *errorMessage() const {
+        return sqlite3_errmsg(db);
+    }
+
+private:
+    void applyProfile(bool readOnly, const SQLProfile &profile);
+};
+
+/**
+ * A fixed set of connections that are lent to one thread at a time
+ */
+class ConnectionPool {
+
+public:
+    /**
+     * A connection borrowed from the pool, it's given back when this goes out of scope
+     */
+    class Lease {
+
+    private:
+        ConnectionPool *pool;
+
+        SQLConnection *connection;
+
+    public:
+        Lease(ConnectionPool *pool, SQLConnection *connection) : pool(pool), connection(connection) {}
+
+        Lease(const Lease &) = delete;
+
+        Lease &operator=(const Lease &) = delete;
+
+        Lease(Lease &&other) noexcept: pool(other.pool), connection(other.connection) {
+            other.connection = nullptr;
+        }
+
+        ~Lease() {
+            if (connection != nullptr) {
+                pool->release(connection);
+            }
+        }
+
+        SQLConnection &operator*() const {
+            return *connection;
+        }
+
+        SQLConnection *operator->() const {
+            return connection;
+        }
+    };
+
+private:
+    std::vector<std::unique_ptr<SQLConnection>> connections;
+
+    std::vector<SQLConnection *> idle;
+
+    std::mutex lock;
+
+    std::condition_variable available;
+
+public:
+    ConnectionPool() = default;
+
+    /**
+     * Add a connection to the pool, should only be called before the pool is used
+     */
+    void add(std::unique_ptr<SQLConnection> connection);
+
+    /**
+     * Borrow a connection, waiting for one to be given back if they are all in use
+     */
+    Lease acquire();
+
+    bool empty() const {
+        return connections.empty();
+    }
+
+private:
+    void release(SQLConnection *connection);
+};
+
+#endif //RASPBERRY_SQLCONNECTION_H
@@ -1,6 +1,6 @@
 #include "SQLDatabase.h"
-
-#define DB_FILE_NAME "parkingspaces.db"
+#include "../log/logger.h"
+#include "../metrics/metrics.h"
 
 /**
  * When the STATE is RESERVED, the OCCUPANT column represents the license plate of the car that reserved
@@ -17,85 +17,204 @@
 
 #define CREATE_CHANGE_INDEX "CREATE INDEX IF NOT EXISTS CHANGE ON SPACES(LAST_CHANGE);"
 
+/**
+ * The columns every select returns, in the order readSpaceRow expects them
+ */
+#define SPACE_COLUMNS "PID, SECTION, STATE, OCCUPANT_PLATE, LAST_CHANGE"
+
 #define INSERT_SPACE "INSERT INTO SPACES(PID, SECTION, LAST_CHANGE) values(?, ?, strftime('%s', 'now'))"
 
 #define UPDATE_SPACE "UPDATE SPACES SET STATE=?, OCCUPANT_PLATE=?, LAST_CHANGE=strftime('%s', 'now') WHERE PID=?"
 
 #define UPDATE_SPACE_PLATE "UPDATE SPACES SET OCCUPANT_PLATE=? WHERE PID=?"
 
-#define SELECT_SPACES "SELECT PID, SECTION, STATE, OCCUPANT_PLATE, LAST_CHANGE FROM SPACES"
+#define SELECT_SPACES "SELECT " SPACE_COLUMNS " FROM SPACES"
 
-#define SELECT_SPACE "SELECT * FROM SPACES WHERE PID=?"
+#define SELECT_SPACE "SELECT " SPACE_COLUMNS " FROM SPACES WHERE PID=?"
 
 #define MAKE_RESERVATION "UPDATE SPACES SET STATE=?, OCCUPANT_PLATE=?, LAST_CHANGE=strftime('%s', 'now') WHERE PID=? AND STATE=?;"
 
-#define SELECT_EXPIRED_RESERVATIONS "SELECT * FROM SPACES WHERE STATE=1 AND LAST_CHANGE<=strftime('%s', 'now', '-45 minutes')"
+#define SELECT_EXPIRED_RESERVATIONS "SELECT " SPACE_COLUMNS " FROM SPACES WHERE STATE=1 AND LAST_CHANGE<=strftime('%s', 'now', '-45 minutes')"
 
-#define SELECT_RESERVATION_FOR "SELECT * FROM SPACES WHERE OCCUPANT_PLATE=? AND STATE=?"
+#define SELECT_RESERVATION_FOR "SELECT " SPACE_COLUMNS " FROM SPACES WHERE OCCUPANT_PLATE=? AND STATE=?"
 
-#define SELECT_SPACE_OCCUPIED_BY "SELECT * FROM SPACES WHERE OCCUPANT_PLATE=? AND STATE=?"
+#define SELECT_SPACE_OCCUPIED_BY "SELECT " SPACE_COLUMNS " FROM SPACES WHERE OCCUPANT_PLATE=? AND STATE=?"
 
 #define DELETE_RESERVATION_FOR_SPACE "UPDATE SPACES SET STATE=?, LAST_CHANGE=strftime('%s', 'now') WHERE PID=? AND STATE=?"
 
 #define DELETE_RESERVATION_FOR_PLATE "UPDATE SPACES SET STATE=?, OCCUPANT_PLATE=NULL, LAST_CHANGE=strftime('%s', 'now') WHERE OCCUPANT_PLATE=? AND STATE=?"
 
+#define CLEAR_SPACE_PLATE "UPDATE SPACES SET OCCUPANT_PLATE=NULL WHERE PID=?"
+
+#define PERSIST_SPACE "INSERT INTO SPACES(PID, SECTION, STATE, LAST_CHANGE, OCCUPANT_PLATE) values(?, ?, ?, ?, ?)"\
+                      " ON CONFLICT(PID) DO UPDATE SET SECTION=excluded.SECTION, STATE=excluded.STATE,"\
+                      " LAST_CHANGE=excluded.LAST_CHANGE, OCCUPANT_PLATE=excluded.OCCUPANT_PLATE"
+
+#define BEGIN_TRANSACTION "BEGIN IMMEDIATE"
+
+#define COMMIT_TRANSACTION "COMMIT"
+
+#define ROLLBACK_TRANSACTION "ROLLBACK"
+
 #define CREATE_LOG_TABLE "CREATE TABLE IF NOT EXISTS ENTRANCE_LOG(PLATE varchar(20) NOT NULL, "\
                     "LOG_TYPE ENUM('ENTRY', 'EXIT') NOT NULL, LOG_TIME TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP," \
                     "INDEX PLATE_IND (PLATE), INDEX TIME_IND(LOG_TIME));"
 
 #define INSERT_LOG_ENTRY "INSERT INTO ENTRANCE_LOG (PLATE, LOG_TYPE) values(?, ?);"
 
+/**
+ * The statements that are kept prepared in the statement cache, in the same order as STATEMENTS
+ */
+enum PreparedStatement {
+    S_INSERT_SPACE,
+    S_UPDATE_SPACE,
+    S_UPDATE_SPACE_PLATE,
+    S_SELECT_SPACES,
+    S_SELECT_SPACE,
+    S_MAKE_RESERVATION,
+    S_SELECT_EXPIRED_RESERVATIONS,
+    S_SELECT_RESERVATION_FOR,
+    S_SELECT_SPACE_OCCUPIED_BY,
+    S_DELETE_RESERVATION_FOR_SPACE,
+    S_DELETE_RESERVATION_FOR_PLATE,
+    S_CLEAR_SPACE_PLATE,
+    S_PERSIST_SPACE,
+    S_BEGIN_TRANSACTION,
+    S_COMMIT_TRANSACTION,
+    S_ROLLBACK_TRANSACTION,
+    S_STATEMENT_COUNT
+};
+
+static const char *const STATEMENTS[S_STATEMENT_COUNT] = {
+        INSERT_SPACE,
+        UPDATE_SPACE,
+        UPDATE_SPACE_PLATE,
+        SELECT_SPACES,
+        SELECT_SPACE,
+        MAKE_RESERVATION,
+        SELECT_EXPIRED_RESERVATIONS,
+        SELECT_RESERVATION_FOR,
+        SELECT_SPACE_OCCUPIED_BY,
+        DELETE_RESERVATION_FOR_SPACE,
+        DELETE_RESERVATION_FOR_PLATE,
+        CLEAR_SPACE_PLATE,
+        PERSIST_SPACE,
+        BEGIN_TRANSACTION,
+        COMMIT_TRANSACTION,
+        ROLLBACK_TRANSACTION
+};
+
+/**
+ * The time of every call, including the wait for the writer or for a reader connection
+ */
+static Histogram &callLatency(const char *op) {
+    return Metrics::instance().histogram("parking_db_call_seconds", "The time spent in the database calls",
+                                         std::string("op=\"") + op + "\"");
+}
+
+static Histogram &insertSpaceLatency = callLatency("insert");
+static Histogram &fetchAllSpaceStatesLatency = callLatency("read_all");
+static Histogram &getStateForSpaceLatency = callLatency("read_space");
+static Histogram &getExpiredReserveStatesLatency = callLatency("read_expired");
+static Histogram &updateSpaceStateLatency = callLatency("update_state");
+static Histogram &updateSpacePlateLatency = callLatency("update_plate");
+static Histogram &applySpaceUpdatesLatency = callLatency("apply_updates");
+static Histogram &getReservationForLicensePlateLatency = callLatency("read_reservation");
+static Histogram &getSpaceOccupiedByLicensePlateLatency = callLatency("read_occupied");
+static Histogram &attemptToReserveSpotLatency = callLatency("reserve");
+static Histogram &cancelReservationsForLatency = callLatency("cancel_reservations");
+static Histogram &cancelReservationForSpotLatency = callLatency("cancel_reservation");
+static Histogram &persistSpacesLatency = callLatency("persist");
+
+/**
+ * Read the current row of a statement that selects SPACE_COLUMNS
+ */
+static SpaceState readSpaceRow(sqlite3_stmt *stmt) {
+
+    auto section = (const char *) sqlite3_column_text(stmt, 1);
+
+    auto occupant = (const char *) sqlite3_column_text(stmt, 3);
+
+    return SpaceState(sqlite3_column_int(stmt, 0),
+                      static_cast<parkingspaces::SpaceStates>(sqlite3_column_int(stmt, 2)),
+                      std::string(section == nullptr ? "" : section),
+                      std::string(occupant == nullptr ? "" : occupant),
+                      sqlite3_column_int64(stmt, 4));
+}
+
 void SQLDatabase::createTable() {
 
     char *errMsg = 0;
 
-    int rs = sqlite3_exec(this->db, CREATE_PARKING_SPACES_TABLE, nullptr, nullptr, &errMsg);
+    int rs = sqlite3_exec(this->writer->handle(), CREATE_PARKING_SPACES_TABLE, nullptr, nullptr, &errMsg);
 
     if (rs != SQLITE_OK && rs != SQLITE_DONE) {
-        std::cout << errMsg << std::endl;
+        LOG_ERROR("Failed to create the table", {"error", errMsg});
 
         exit(1);
     } else {
-        std::cout << "Created the table" << std::endl;
+        LOG_INFO("Created the table");
     }
 
-    rs = sqlite3_exec(this->db, CREATE_CHANGE_INDEX, nullptr, nullptr, &errMsg);
+    rs = sqlite3_exec(this->writer->handle(), CREATE_CHANGE_INDEX, nullptr, nullptr, &errMsg);
     if (rs != SQLITE_OK && rs != SQLITE_DONE) {
-        std::cout << errMsg << std::endl;
+        LOG_ERROR("Failed to create the change index", {"error", errMsg});
 
         exit(1);
     } else {
-        std::cout << "Created the table" << std::endl;
+        LOG_INFO("Created the change index");
     }
 
 }
 
-SQLDatabase::SQLDatabase() : db(nullptr) {
+SQLDatabase::SQLDatabase(const std::string &fileName, const SQLProfile &profile) :
+        writer(std::make_unique<SQLConnection>(fileName, false, profile)) {
 
-    int result = sqlite3_open(DB_FILE_NAME, &this->db);
+    createTable();
 
-    if (result) {
+    //The statements can only be prepared after the tables they use exist
+    this->writer->prepareStatements(STATEMENTS, S_STATEMENT_COUNT);
 
-        std::cout << "Failed to open database!" << std::endl;
+    if (profile.usesWAL()) {
+        //Without WAL the readers would just wait for the writer to finish, so only use them with it
+        for (int i = 0; i < profile.readerConnections; i++) {
+            auto reader = std::make_unique<SQLConnection>(fileName, true, profile);
 
-        exit(EXIT_FAILURE);
-    } else {
-        createTable();
+            reader->prepareStatements(STATEMENTS, S_STATEMENT_COUNT);
+
+            this->readers.add(std::move(reader));
+        }
+
+        if (profile.checkpointIntervalSeconds > 0) {
+            this->checkpointer = std::make_unique<WalCheckpointer>(fileName, profile.checkpointIntervalSeconds);
+        }
     }
 
 }
 
 SQLDatabase::~SQLDatabase() {
 
-    sqlite3_close(this->db);
+    this->checkpointer.reset();
 
 }
 
-void SQLDatabase::insertSpace(unsigned int spaceID, const std::string &section) {
+template<typename F>
+auto SQLDatabase::withReader(F read) {
 
-    sqlite3_stmt *stmt;
+    if (this->readers.empty()) {
+        std::unique_lock<std::mutex> lock(this->writerLock);
 
-    sqlite3_prepare_v2(this->db, INSERT_SPACE, strlen(INSERT_SPACE), &stmt, nullptr);
+        return read(*this->writer);
+    }
+
+    auto reader = this->readers.acquire();
+
+    return read(*reader);
+}
+
+bool SQLDatabase::writeInsertSpace(unsigned int spaceID, const std::string &section) {
+
+    auto stmt = this->writer->get(S_INSERT_SPACE);
 
     sqlite3_bind_int(stmt, 1, spaceID);
     sqlite3_bind_text(stmt, 2, section.c_str(), section.length(), nullptr);
@@ -104,27 +223,31 @@ void SQLDatabase::insertSpace(unsigned int spaceID, const std::string &section)
 
     if (rc == SQLITE_OK || rc == SQLITE_DONE) {
         //completed successfully
-    } else {
-        std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
+        return true;
     }
 
-    sqlite3_finalize(stmt);
+    LOG_ERROR("Failed to insert the space", {"space", spaceID}, {"error", this->writer->errorMessage()});
 
+    return false;
 }
 
-std::optional<SpaceState>
-SQLDatabase::updateSpaceState(unsigned int spaceID, parkingspaces::SpaceStates state, const std::string &licensePlate) {
+void SQLDatabase::insertSpace(unsigned int spaceID, const std::string &section) {
 
-    auto prevState = this->getStateForSpace(spaceID);
+    ScopedTimer timer(insertSpaceLatency);
 
-    sqlite3_stmt *stmt;
+    std::unique_lock<std::mutex> lock(this->writerLock);
+
+    writeInsertSpace(spaceID, section);
+}
 
-    sqlite3_prepare_v2(this->db, UPDATE_SPACE, strlen(UPDATE_SPACE), &stmt, nullptr);
+bool SQLDatabase::writeSpaceState(unsigned int spaceID, parkingspaces::SpaceStates state, const std::string &licensePlate) {
+
+    auto stmt = this->writer->get(S_UPDATE_SPACE);
 
     sqlite3_bind_int(stmt, 1, state);
 
     if (licensePlate.empty()) {
-        sqlite3_bind_text(stmt, 2, nullptr, 0, nullptr);
+        sqlite3_bind_null(stmt, 2);
     } else {
         sqlite3_bind_text(stmt, 2, licensePlate.c_str(), licensePlate.length(), nullptr);
     }
@@ -133,20 +256,80 @@ SQLDatabase::updateSpaceState(unsigned int spaceID, parkingspaces::SpaceStates s
     int rc = sqlite3_step(stmt);
 
     if (rc != SQLITE_OK && rc != SQLITE_DONE) {
-        std::cout << "ERR2 :" << sqlite3_errmsg(this->db) << std::endl;
+        LOG_ERROR("Failed to write the space state", {"space", spaceID}, {"error", this->writer->errorMessage()});
+
+        return false;
     }
 
-    sqlite3_finalize(stmt);
+    return true;
+}
+
+std::optional<SpaceState>
+SQLDatabase::updateSpaceState(unsigned int spaceID, parkingspaces::SpaceStates state, const std::string &licensePlate) {
+
+    ScopedTimer timer(updateSpaceStateLatency);
+
+    std::unique_lock<std::mutex> lock(this->writerLock);
+
+    auto prevState = this->readSpace(*this->writer, spaceID);
+
+    writeSpaceState(spaceID, state, licensePlate);
 
     return prevState;
 }
 
+std::vector<SpaceState> SQLDatabase::applySpaceUpdates(const std::vector<SpaceUpdate> &updates) {
+
+    ScopedTimer timer(applySpaceUpdatesLatency);
+
+    std::vector<SpaceState> prevStates;
+
+    prevStates.reserve(updates.size());
+
+    std::unique_lock<std::mutex> lock(this->writerLock);
+
+    //A single transaction means a single journal sync for the whole batch, instead of one per space
+    if (!runStatement(S_BEGIN_TRANSACTION)) {
+        return prevStates;
+    }
+
+    for (const auto &update : updates) {
+
+        auto prevState = this->readSpace(*this->writer, update.spaceID);
+
+        if (!prevState) {
+            writeInsertSpace(update.spaceID, update.section);
+
+            prevState = this->readSpace(*this->writer, update.spaceID);
+
+            if (!prevState) {
+                prevState = SpaceState(update.spaceID, parkingspaces::SpaceStates::FREE, update.section, std::string());
+            }
+        }
+
+        //Failing to update a single space (For example because of a duplicate plate) does not fail the batch
+        writeSpaceState(update.spaceID, update.state, update.licensePlate);
+
+        prevStates.push_back(std::move(*prevState));
+    }
+
+    if (!runStatement(S_COMMIT_TRANSACTION)) {
+        runStatement(S_ROLLBACK_TRANSACTION);
+
+        //Nothing of the batch was written
+        prevStates.clear();
+    }
+
+    return prevStates;
+}
 
 bool SQLDatabase::attemptToReserveSpot(unsigned int spaceID, const std::string &licensePlate) {
 
-    sqlite3_stmt *stmt;
+    ScopedTimer timer(attemptToReserveSpotLatency);
 
-    sqlite3_prepare_v2(this->db, MAKE_RESERVATION, strlen(MAKE_RESERVATION), &stmt, nullptr);
+    std::unique_lock<std::mutex> lock(this->writerLock);
+
+    auto stmt = this->writer->get(S_MAKE_RESERVATION);
 
     sqlite3_bind_int(stmt, 1, parkingspaces::SpaceStates::RESERVED);
 
@@ -158,25 +341,24 @@ bool SQLDatabase::attemptToReserveSpot(unsigned int spaceID, const std::string &
 
     int rc = sqlite3_step(stmt);
 
-    sqlite3_finalize(stmt);
-
     if (rc != SQLITE_OK && rc != SQLITE_DONE) {
-        std::cout << "ERR RESERVE:" << sqlite3_errmsg(this->db) << std::endl;
+        LOG_ERROR("Failed to reserve the space", {"space", spaceID}, {"error", this->writer->errorMessage()});
 
         return false;
     }
 
-    int changes = sqlite3_changes(this->db);
+    int changes = this->writer->changes();
 
     return changes > 0;
 }
 
 bool SQLDatabase::cancelReservationsFor(const std::string &licensePlate) {
 
-    sqlite3_stmt *stmt;
+    ScopedTimer timer(cancelReservationsForLatency);
+
+    std::unique_lock<std::mutex> lock(this->writerLock);
 
-    sqlite3_prepare_v2(this->db, DELETE_RESERVATION_FOR_PLATE, strlen(DELETE_RESERVATION_FOR_PLATE), &stmt,
-                       nullptr);
+    auto stmt = this->writer->get(S_DELETE_RESERVATION_FOR_PLATE);
 
     sqlite3_bind_int(stmt, 1, parkingspaces::SpaceStates::FREE);
 
@@ -186,263 +368,248 @@ bool SQLDatabase::cancelReservationsFor(const std::string &licensePlate) {
     int res = sqlite3_step(stmt);
 
     if (res == SQLITE_OK || res == SQLITE_DONE) {
-        sqlite3_finalize(stmt);
 
-        int changes = sqlite3_changes(db);
+        int changes = this->writer->changes();
 
         return changes > 0;
     }
 
-    std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
-    sqlite3_finalize(stmt);
+    LOG_ERROR("Failed to cancel the reservations", {"plate", licensePlate}, {"error", this->writer->errorMessage()});
 
     return false;
 }
 
-std::unique_ptr<std::vector<SpaceState>> SQLDatabase::fetchAllSpaceStates() {
+std::unique_ptr<std::vector<SpaceState>> SQLDatabase::readSpaces(SQLConnection &conn, sqlite3_stmt *stmt) {
 
     auto states = std::make_unique<std::vector<SpaceState>>();
 
-    sqlite3_stmt *stmt;
-
-    sqlite3_prepare_v2(this->db, SELECT_SPACES, strlen(SELECT_SPACES), &stmt, nullptr);
-
     while (true) {
         int res = sqlite3_step(stmt);
 
         if (res == SQLITE_DONE) break;
 
         else if (res != SQLITE_ROW) {
-            std::cout << "Failed to read row from DB" << std::endl;
-            std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
+            LOG_ERROR("Failed to read row from DB", {"error", conn.errorMessage()});
             break;
         }
 
-        auto statement = (const char *) sqlite3_column_text(stmt, 3);
+        states->push_back(readSpaceRow(stmt));
+    }
 
-        std::string occupant;
+    return states;
+}
 
-        if (statement != nullptr) {
-            occupant = std::string(statement);
-        }
+std::unique_ptr<std::vector<SpaceState>> SQLDatabase::fetchAllSpaceStates() {
 
-        states->emplace_back(sqlite3_column_int(stmt, 0),
-                             static_cast<parkingspaces::SpaceStates>(sqlite3_column_int(stmt, 2)),
-                             std::string((const char *) sqlite3_column_text(stmt, 1)),
-                             occupant);
-    }
+    ScopedTimer timer(fetchAllSpaceStatesLatency);
 
-    sqlite3_finalize(stmt);
+    return withReader([this](SQLConnection &conn) {
+        auto stmt = conn.get(S_SELECT_SPACES);
 
-    return std::move(states);
+        return readSpaces(conn, stmt);
+    });
 }
 
-std::optional<SpaceState> SQLDatabase::getStateForSpace(unsigned int spaceID) {
-
-    sqlite3_stmt *stmt;
+std::optional<SpaceState> SQLDatabase::readSpace(SQLConnection &conn, unsigned int spaceID) {
 
-    sqlite3_prepare_v2(this->db, SELECT_SPACE, strlen(SELECT_SPACE), &stmt, nullptr);
+    auto stmt = conn.get(S_SELECT_SPACE);
 
     sqlite3_bind_int(stmt, 1, spaceID);
 
     int res = sqlite3_step(stmt);
 
     if (res != SQLITE_ROW && res != SQLITE_DONE && res != SQLITE_OK) {
-        std::cout << "No space by that ID" << std::endl;
-        std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
+        LOG_ERROR("Failed to read the space", {"space", spaceID}, {"error", conn.errorMessage()});
 
         return std::nullopt;
-    } else if (res == SQLITE_DONE) {
+    } else if (res != SQLITE_ROW) {
         return std::nullopt;
     }
 
-    spaceID = sqlite3_column_int(stmt, 0);
-
-    std::string section((const char *) sqlite3_column_text(stmt, 1));
-
-    auto state = static_cast<parkingspaces::SpaceStates>(sqlite3_column_int(stmt, 2));
-
-    int last_change = sqlite3_column_int(stmt, 3);
-
-    const char *str = (const char *) sqlite3_column_text(stmt, 4);
+    return readSpaceRow(stmt);
+}
 
-    std::string occupant(str == nullptr ? "" : str);
+std::optional<SpaceState> SQLDatabase::getStateForSpace(unsigned int spaceID) {
 
-    sqlite3_finalize(stmt);
+    ScopedTimer timer(getStateForSpaceLatency);
 
-    return SpaceState(spaceID, state, section, occupant);
+    return withReader([this, spaceID](SQLConnection &conn) {
+        return readSpace(conn, spaceID);
+    });
 }
 
-std::optional<SpaceState> SQLDatabase::getReservationForLicensePlate(const std::string &licensePlate) {
-
-    sqlite3_stmt *stmt;
+std::optional<SpaceState> SQLDatabase::readSpaceWithPlate(SQLConnection &conn, size_t statement,
+                                                          const std::string &licensePlate,
+                                                          parkingspaces::SpaceStates state) {
 
-    sqlite3_prepare_v2(this->db, SELECT_RESERVATION_FOR, strlen(SELECT_RESERVATION_FOR), &stmt, nullptr);
+    auto stmt = conn.get(statement);
 
     sqlite3_bind_text(stmt, 1, licensePlate.c_str(), licensePlate.length(), nullptr);
 
-    sqlite3_bind_int(stmt, 2, parkingspaces::SpaceStates::RESERVED);
+    sqlite3_bind_int(stmt, 2, state);
 
     int res = sqlite3_step(stmt);
 
-    if (res != SQLITE_ROW && res != SQLITE_OK && res != SQLITE_DONE) {
-
-        sqlite3_finalize(stmt);
+    if (res != SQLITE_ROW) {
 
-        std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
+        if (res != SQLITE_DONE) {
+            LOG_ERROR("Failed to read the space", {"error", conn.errorMessage()});
+        }
 
         return std::nullopt;
     }
 
-    int spaceID = sqlite3_column_int(stmt, 0);
-
-    auto statement = (const char *) sqlite3_column_text(stmt, 3);
-
-    std::string occupant;
-
-    if (statement != nullptr) {
-        occupant = std::string(statement);
-    }
-
-    auto spaceState = static_cast<parkingspaces::SpaceStates>(sqlite3_column_int(stmt, 2));
+    return readSpaceRow(stmt);
+}
 
-    SpaceState spaceInfo{spaceID, spaceState,
-                         std::string((const char *) sqlite3_column_text(stmt, 1)),
-                         occupant};
+std::optional<SpaceState> SQLDatabase::getReservationForLicensePlate(const std::string &licensePlate) {
 
-    sqlite3_finalize(stmt);
+    ScopedTimer timer(getReservationForLicensePlateLatency);
 
-    return spaceInfo;
+    return withReader([this, &licensePlate](SQLConnection &conn) {
+        return readSpaceWithPlate(conn, S_SELECT_RESERVATION_FOR, licensePlate, parkingspaces::SpaceStates::RESERVED);
+    });
 }
 
 std::optional<SpaceState> SQLDatabase::getSpaceOccupiedByLicensePlate(const std::string &licensePlate) {
 
-    sqlite3_stmt *stmt;
+    ScopedTimer timer(getSpaceOccupiedByLicensePlateLatency);
 
-    sqlite3_prepare_v2(this->db, SELECT_SPACE_OCCUPIED_BY, strlen(SELECT_SPACE_OCCUPIED_BY), &stmt, nullptr);
-
-    sqlite3_bind_text(stmt, 1, licensePlate.c_str(), licensePlate.length(), nullptr);
+    return withReader([this, &licensePlate](SQLConnection &conn) {
+        return readSpaceWithPlate(conn, S_SELECT_SPACE_OCCUPIED_BY, licensePlate, parkingspaces::SpaceStates::OCCUPIED);
+    });
+}
 
-    sqlite3_bind_int(stmt, 2, parkingspaces::SpaceStates::OCCUPIED);
+std::unique_ptr<std::vector<SpaceState>> SQLDatabase::getExpiredReserveStates() {
 
-    int res = sqlite3_step(stmt);
+    ScopedTimer timer(getExpiredReserveStatesLatency);
 
-    if (res != SQLITE_ROW) {
+    auto spaces = withReader([this](SQLConnection &conn) {
+        auto stmt = conn.get(S_SELECT_EXPIRED_RESERVATIONS);
 
-        std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
+        return readSpaces(conn, stmt);
+    });
 
-        sqlite3_finalize(stmt);
-        return std::nullopt;
+    for (const auto &space : *spaces) {
+        LOG_DEBUG("Expired reservation", {"space", space.getSpaceId()}, {"state", space.getState()});
     }
 
-    int spaceID = sqlite3_column_int(stmt, 0);
+    return spaces;
+}
 
-    auto statement = (const char *) sqlite3_column_text(stmt, 3);
+bool SQLDatabase::cancelReservationForSpot(int spaceID) {
 
-    std::string occupant;
+    ScopedTimer timer(cancelReservationForSpotLatency);
 
-    if (statement != nullptr) {
-        occupant = std::string(statement);
-    }
+    std::unique_lock<std::mutex> lock(this->writerLock);
 
-    auto spaceState = static_cast<parkingspaces::SpaceStates>(sqlite3_column_int(stmt, 2));
+    auto stmt = this->writer->get(S_DELETE_RESERVATION_FOR_SPACE);
 
-    SpaceState spaceInfo{spaceID, spaceState,
-                         std::string((const char *) sqlite3_column_text(stmt, 1)),
-                         occupant};
+    sqlite3_bind_int(stmt, 1, parkingspaces::SpaceStates::FREE);
+    sqlite3_bind_int(stmt, 2, spaceID);
+    sqlite3_bind_int(stmt, 3, parkingspaces::SpaceStates::RESERVED);
 
-    sqlite3_finalize(stmt);
+    int res = sqlite3_step(stmt);
 
-    return spaceInfo;
-}
+    if (res != SQLITE_DONE && res != SQLITE_OK) {
 
-std::unique_ptr<std::vector<SpaceState>> SQLDatabase::getExpiredReserveStates() {
+        LOG_ERROR("Failed to cancel the reservation", {"space", spaceID}, {"error", this->writer->errorMessage()});
+        return false;
+    }
 
-    sqlite3_stmt *stmt;
+    int changes = this->writer->changes();
 
-    sqlite3_prepare_v2(this->db, SELECT_EXPIRED_RESERVATIONS, strlen(SELECT_EXPIRED_RESERVATIONS), &stmt, nullptr);
+    return changes > 0;
+}
 
-//    sqlite3_bind_int(stmt, 1, parkingspaces::SpaceStates::RESERVED);
-//    sqlite3_bind_int(stmt, 2, RESERVATION_EXPIRATION);
+bool SQLDatabase::updateSpacePlate(unsigned int spaceID, const std::string &licensePlate) {
 
-    auto spaces = std::make_unique<std::vector<SpaceState>>();
+    ScopedTimer timer(updateSpacePlateLatency);
 
-    while (true) {
+    std::unique_lock<std::mutex> lock(this->writerLock);
 
-        int res = sqlite3_step(stmt);
+    auto stmt = this->writer->get(S_UPDATE_SPACE_PLATE);
 
-        if (res == SQLITE_DONE) break;
-        else if (res != SQLITE_ROW) {
-            std::cout << "Failed to read row from DB" << std::endl;
-            std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
-            break;
-        }
+    sqlite3_bind_text(stmt, 1, licensePlate.c_str(), licensePlate.length(), nullptr);
 
-        auto statement = (const char *) sqlite3_column_text(stmt, 3);
+    sqlite3_bind_int(stmt, 2, spaceID);
 
-        std::string occupant;
+    int ok = sqlite3_step(stmt);
 
-        if (statement != nullptr) {
-            occupant = std::string(statement);
-        }
+    if (ok != SQLITE_DONE && ok != SQLITE_OK) {
+        return false;
+    }
 
-        std::cout << "SpaceID: " << sqlite3_column_int(stmt, 0) << " State " << sqlite3_column_int(stmt, 2)
-                  << std::endl;
+    return true;
+}
 
-        spaces->emplace_back(sqlite3_column_int(stmt, 0),
-                             static_cast<parkingspaces::SpaceStates>(sqlite3_column_int(stmt, 2)),
-                             std::string((const char *) sqlite3_column_text(stmt, 1)),
-                             occupant);
-    }
+bool SQLDatabase::runStatement(size_t statement) {
 
-    sqlite3_finalize(stmt);
+    auto stmt = this->writer->get(statement);
 
-    return std::move(spaces);
-}
+    int rc = sqlite3_step(stmt);
 
-bool SQLDatabase::cancelReservationForSpot(int spaceID) {
+    if (rc != SQLITE_DONE && rc != SQLITE_OK) {
+        LOG_ERROR("Failed to run the statement", {"statement", statement}, {"error", this->writer->errorMessage()});
 
-    sqlite3_stmt *stmt;
+        return false;
+    }
 
-    sqlite3_prepare_v2(this->db, DELETE_RESERVATION_FOR_SPACE, strlen(DELETE_RESERVATION_FOR_SPACE), &stmt, nullptr);
+    return true;
+}
 
-    sqlite3_bind_int(stmt, 1, parkingspaces::SpaceStates::FREE);
-    sqlite3_bind_int(stmt, 2, spaceID);
-    sqlite3_bind_int(stmt, 3, parkingspaces::SpaceStates::RESERVED);
+bool SQLDatabase::persistSpaces(const std::vector<SpaceState> &spaces) {
 
-    int res = sqlite3_step(stmt);
+    ScopedTimer timer(persistSpacesLatency);
 
-    if (res != SQLITE_DONE && res != SQLITE_OK) {
+    std::unique_lock<std::mutex> lock(this->writerLock);
 
-        std::cout << "ERR:" << sqlite3_errmsg(this->db) << std::endl;
+    if (!runStatement(S_BEGIN_TRANSACTION)) {
         return false;
     }
 
-    int changes = sqlite3_changes(db);
+    //Plates are unique, so release the plates of every row first, otherwise a car that moved between two
+    //Of these spaces would conflict with the row that has not been written yet
+    for (const auto &space : spaces) {
+        auto stmt = this->writer->get(S_CLEAR_SPACE_PLATE);
 
-    sqlite3_finalize(stmt);
+        sqlite3_bind_int(stmt, 1, space.getSpaceId());
 
-    return changes > 0;
-}
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            LOG_ERROR("Failed to persist the spaces", {"space", space.getSpaceId()}, {"error", this->writer->errorMessage()});
 
-bool SQLDatabase::updateSpacePlate(unsigned int spaceID, const std::string &licensePlate) {
+            runStatement(S_ROLLBACK_TRANSACTION);
+            return false;
+        }
+    }
 
-    sqlite3_stmt *stmt;
+    for (const auto &space : spaces) {
+        auto stmt = this->writer->get(S_PERSIST_SPACE);
 
-    sqlite3_prepare_v2(this->db, UPDATE_SPACE_PLATE, strlen(UPDATE_SPACE_PLATE), &stmt, nullptr);
+        sqlite3_bind_int(stmt, 1, space.getSpaceId());
+        sqlite3_bind_text(stmt, 2, space.getSection().c_str(), space.getSection().length(), nullptr);
+        sqlite3_bind_int(stmt, 3, space.getState());
+        sqlite3_bind_int64(stmt, 4, space.getLastChange());
 
-    sqlite3_bind_text(stmt, 1, licensePlate.c_str(), licensePlate.length(), nullptr);
-
-    sqlite3_bind_int(stmt, 2, spaceID);
+        if (space.getOccupant().empty()) {
+            sqlite3_bind_null(stmt, 5);
+        } else {
+            sqlite3_bind_text(stmt, 5, space.getOccupant().c_str(), space.getOccupant().length(), nullptr);
+        }
 
-    int ok = sqlite3_step(stmt);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            LOG_ERROR("Failed to persist the spaces", {"space", space.getSpaceId()}, {"error", this->writer->errorMessage()});
 
-    if (ok != SQLITE_DONE && ok != SQLITE_OK) {
-        sqlite3_finalize(stmt);
+            runStatement(S_ROLLBACK_TRANSACTION);
+            return false;
+        }
+    }
 
+    //A failed commit (SQLITE_BUSY) leaves the transaction open, every later BEGIN would fail with it
+    if (!runStatement(S_COMMIT_TRANSACTION)) {
+        runStatement(S_ROLLBACK_TRANSACTION);
         return false;
     }
 
-    sqlite3_finalize(stmt);
     return true;
 }
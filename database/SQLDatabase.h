@@ -3,22 +3,91 @@
 #define RASPBERRY_SQLDATABASE_H
 
 #include "database.h"
+#include "SQLConnection.h"
+#include "SQLProfile.h"
+#include "WalCheckpointer.h"
 #include <sqlite3.h>
-
+#include <mutex>
+
+#define DB_FILE_NAME "parkingspaces.db"
+
+/**
+ * The database stored in SQLite.
+ *
+ * All the changes go through a single writer connection, serialized by the writerLock, while the reads are spread over
+ * a pool of read only connections so they can run in parallel with each other and with the writer.
+ *
+ * The pool is for when the reads reach this database. Behind a MemoryDatabase (As the server runs it) they are all
+ * answered from memory, so it's opened without readers there
+ */
 class SQLDatabase : public Database {
 
 private:
 
-    sqlite3 *db;
+    std::unique_ptr<SQLConnection> writer;
+
+    /**
+     * Serializes the use of the writer connection (and therefore of its statement cache) between the gRPC threads,
+     * the expiration thread and the arduino receiver thread
+     */
+    std::mutex writerLock;
+
+    /**
+     * Empty when the journal is not in WAL mode, then the reads go through the writer
+     */
+    ConnectionPool readers;
+
+    /**
+     * Only used when the journal is in WAL mode and the profile asks for a checkpoint interval
+     */
+    std::unique_ptr<WalCheckpointer> checkpointer;
 
 public:
-    SQLDatabase();
+    explicit SQLDatabase(const std::string &fileName = DB_FILE_NAME, const SQLProfile &profile = SQLProfile());
 
     ~SQLDatabase();
 
 private:
     void createTable();
 
+    /**
+     * Run a read on one of the reader connections, or on the writer if there are no readers
+     */
+    template<typename F>
+    auto withReader(F read);
+
+    /**
+     * Read the state of a space, the connection must be held by the calling thread
+     * @param spaceID
+     * @return
+     */
+    std::optional<SpaceState> readSpace(SQLConnection &conn, unsigned int spaceID);
+
+    /**
+     * Read a single space from a statement that selects by the occupant plate and the space state,
+     * the connection must be held by the calling thread
+     */
+    std::optional<SpaceState> readSpaceWithPlate(SQLConnection &conn, size_t statement,
+                                                 const std::string &licensePlate, parkingspaces::SpaceStates state);
+
+    std::unique_ptr<std::vector<SpaceState>> readSpaces(SQLConnection &conn, sqlite3_stmt *stmt);
+
+    /**
+     * Step a statement on the writer that takes no parameters, the writer lock must already be held
+     * @return Whether it completed successfully
+     */
+    bool runStatement(size_t statement);
+
+    /**
+     * Insert a space, the writer lock must already be held
+     */
+    bool writeInsertSpace(unsigned int spaceID, const std::string &section);
+
+    /**
+     * Update the state of a space, the writer lock must already be held
+     */
+    bool writeSpaceState(unsigned int spaceID, parkingspaces::SpaceStates state, const std::string &licensePlate);
+
 public:
     void insertSpace(unsigned int spaceID, const std::string &section) override;
 
@@ -38,6 +107,8 @@ public:
 
     bool updateSpacePlate(unsigned int spaceID, const std::string  &licensePlate) override;
 
+    std::vector<SpaceState> applySpaceUpdates(const std::vector<SpaceUpdate> &updates) override;
+
     std::optional<SpaceState> getReservationForLicensePlate(const std::string &licensePlate) override;
 
     std::optional<SpaceState> getSpaceOccupiedByLicensePlate(const std::string &licensePlate) override;
@@ -48,6 +119,16 @@ public:
 
     bool cancelReservationForSpot(int spaceID) override;
 
+    /**
+     * Write the full row of each space (Including the time of the last change) in a single transaction,
+     * inserting the spaces that do not exist yet
+     *
+     * Used by the MemoryDatabase to persist its dirty rows
+     * @param spaces
+     * @return Whether the transaction was committed
+     */
+    bool persistSpaces(const std::vector<SpaceState> &spaces);
+
 };
 
 
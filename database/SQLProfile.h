@@ -0,0 +1,78 @@
+#ifndef RASPBERRY_SQLPROFILE_H
+#define RASPBERRY_SQLPROFILE_H
+
+#include <string>
+
+#define DEFAULT_JOURNAL_MODE "WAL"
+
+/**
+ * With WAL, NORMAL only syncs on checkpoints, a power loss can lose the last transactions but never corrupts the database
+ */
+#define DEFAULT_SYNCHRONOUS "NORMAL"
+
+#define DEFAULT_MMAP_SIZE (64 * 1024 * 1024)
+
+#define DEFAULT_CACHE_SIZE_KB (8 * 1024)
+
+#define DEFAULT_TEMP_STORE "MEMORY"
+
+#define DEFAULT_CHECKPOINT_INTERVAL 30
+
+#define DEFAULT_READER_CONNECTIONS 4
+
+#define DEFAULT_BUSY_TIMEOUT_MS 5000
+
+/**
+ * The settings the SQLite connections are opened with
+ */
+struct SQLProfile {
+
+    /**
+     * PRAGMA journal_mode (DELETE, TRUNCATE, PERSIST, MEMORY, WAL or OFF)
+     */
+    std::string journalMode = DEFAULT_JOURNAL_MODE;
+
+    /**
+     * PRAGMA synchronous (OFF, NORMAL, FULL or EXTRA)
+     */
+    std::string synchronous = DEFAULT_SYNCHRONOUS;
+
+    /**
+     * PRAGMA mmap_size, in bytes. 0 disables memory mapped IO
+     */
+    long long mmapSize = DEFAULT_MMAP_SIZE;
+
+    /**
+     * PRAGMA cache_size, in KiB
+     */
+    int cacheSizeKb = DEFAULT_CACHE_SIZE_KB;
+
+    /**
+     * PRAGMA temp_store (DEFAULT, FILE or MEMORY)
+     */
+    std::string tempStore = DEFAULT_TEMP_STORE;
+
+    /**
+     * The time between the background WAL checkpoints, in seconds.
+     * When this is 0 (Or the journal is not in WAL mode) SQLite checkpoints on the writer when the log grows
+     */
+    int checkpointIntervalSeconds = DEFAULT_CHECKPOINT_INTERVAL;
+
+    /**
+     * The number of read only connections the reads are spread over.
+     * Readers only run alongside the writer in WAL mode, in any other mode all the reads go through the writer.
+     * 0 sends every read through the writer, for a database whose reads are served elsewhere (A MemoryDatabase)
+     */
+    int readerConnections = DEFAULT_READER_CONNECTIONS;
+
+    /**
+     * How long a connection waits for a lock held by another connection before failing, in milliseconds
+     */
+    int busyTimeoutMs = DEFAULT_BUSY_TIMEOUT_MS;
+
+    bool usesWAL() const {
+        return journalMode == "WAL" || journalMode == "wal";
+    }
+};
+
+#endif //RASPBERRY_SQLPROFILE_H
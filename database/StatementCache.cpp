@@ -0,0 +1,25 @@
+#include "StatementCache.h"
+#include "../log/logger.h"
+#include <cstring>
+
+StatementCache::StatementCache(sqlite3 *db, const char *const *sql, size_t count) : db(db), statements(count, nullptr) {
+
+    for (size_t i = 0; i < count; i++) {
+
+        int rc = sqlite3_prepare_v3(db, sql[i], strlen(sql[i]), SQLITE_PREPARE_PERSISTENT, &statements[i], nullptr);
+
+        if (rc != SQLITE_OK) {
+            LOG_ERROR("Failed to prepare statement", {"sql", sql[i]}, {"error", sqlite3_errmsg(db)});
+
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+StatementCache::~StatementCache() {
+
+    for (auto stmt : statements) {
+        sqlite3_finalize(stmt);
+    }
+
+}
@@ -0,0 +1,84 @@
+#ifndef RASPBERRY_STATEMENTCACHE_H
+#define RASPBERRY_STATEMENTCACHE_H
+
+#include <sqlite3.h>
+#include <vector>
+
+/**
+ * A prepared statement borrowed from a StatementCache.
+ *
+ * When it goes out of scope the statement is reset and its bindings are cleared, so the next
+ * user gets it in the same state as a freshly prepared one.
+ */
+class ScopedStatement {
+
+private:
+    sqlite3_stmt *stmt;
+
+public:
+    explicit ScopedStatement(sqlite3_stmt *stmt) : stmt(stmt) {}
+
+    ScopedStatement(const ScopedStatement &) = delete;
+
+    ScopedStatement &operator=(const ScopedStatement &) = delete;
+
+    ScopedStatement(ScopedStatement &&other) noexcept: stmt(other.stmt) {
+        other.stmt = nullptr;
+    }
+
+    ~ScopedStatement() {
+        if (stmt != nullptr) {
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+        }
+    }
+
+    sqlite3_stmt *get() const {
+        return stmt;
+    }
+
+    operator sqlite3_stmt *() const {
+        return stmt;
+    }
+};
+
+/**
+ * Holds every statement used on a connection, prepared once when the cache is created
+ *
+ * The cache belongs to the SQLConnection it was prepared on and is not thread safe: it must only be used
+ * by the thread that currently holds that connection (The SQLDatabase writer lock, or a lease from its reader pool),
+ * and a statement can only be borrowed by one caller at a time.
+ */
+class StatementCache {
+
+private:
+    sqlite3 *db;
+
+    std::vector<sqlite3_stmt *> statements;
+
+public:
+    /**
+     * Prepare all the given statements on the connection
+     * @param db The connection that owns the statements
+     * @param sql The SQL of each statement, the position in the array is the statement's index
+     * @param count
+     */
+    StatementCache(sqlite3 *db, const char *const *sql, size_t count);
+
+    StatementCache(const StatementCache &) = delete;
+
+    StatementCache &operator=(const StatementCache &) = delete;
+
+    ~StatementCache();
+
+    /**
+     * Borrow a prepared statement
+     * @param index The index of the statement in the array given to the constructor
+     * @return
+     */
+    ScopedStatement get(size_t index) const {
+        return ScopedStatement(statements[index]);
+    }
+};
+
+#endif //RASPBERRY_STATEMENTCACHE_H
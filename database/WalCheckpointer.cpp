@@ -0,0 +1,50 @@
+#include "WalCheckpointer.h"
+#include "../log/logger.h"
+
+WalCheckpointer::WalCheckpointer(const std::string &fileName, int intervalSeconds) : db(nullptr),
+                                                                                     intervalSeconds(intervalSeconds) {
+
+    if (sqlite3_open(fileName.c_str(), &this->db) != SQLITE_OK) {
+        LOG_ERROR("Failed to open the checkpoint connection", {"error", sqlite3_errmsg(this->db)});
+
+        sqlite3_close(this->db);
+        this->db = nullptr;
+
+        return;
+    }
+
+    this->checkpointThread.start([this](std::unique_lock<std::mutex> &waitLock) { checkpointLoop(waitLock); });
+}
+
+WalCheckpointer::~WalCheckpointer() {
+
+    this->checkpointThread.stop();
+
+    sqlite3_close(this->db);
+}
+
+void WalCheckpointer::checkpointLoop(std::unique_lock<std::mutex> &waitLock) {
+
+    while (this->checkpointThread.sleep(waitLock, std::chrono::seconds(this->intervalSeconds))) {
+
+        waitLock.unlock();
+
+        checkpoint();
+
+        waitLock.lock();
+    }
+}
+
+void WalCheckpointer::checkpoint() {
+
+    int logFrames = 0, checkpointed = 0;
+
+    int rc = sqlite3_wal_checkpoint_v2(this->db, nullptr, SQLITE_CHECKPOINT_PASSIVE, &logFrames, &checkpointed);
+
+    if (rc != SQLITE_OK) {
+        LOG_WARN("WAL checkpoint failed", {"error", sqlite3_errmsg(this->db)});
+    } else if (checkpointed < logFrames) {
+        //A reader was still using the older frames, they will be copied on the next checkpoint
+        LOG_DEBUG("WAL checkpoint incomplete", {"copied", checkpointed}, {"frames", logFrames});
+    }
+}
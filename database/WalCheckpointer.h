@@ -0,0 +1,34 @@
+#ifndef RASPBERRY_WALCHECKPOINTER_H
+#define RASPBERRY_WALCHECKPOINTER_H
+
+#include <sqlite3.h>
+#include "../util/backgroundloop.h"
+#include <string>
+
+/**
+ * Periodically checkpoints the write ahead log into the database file from a background thread.
+ *
+ * It uses its own connection and passive checkpoints, so it never waits for (or blocks) the writer or the readers,
+ * Which means the writes never have to pay for the checkpoints themselves.
+ */
+class WalCheckpointer {
+
+private:
+    sqlite3 *db;
+
+    int intervalSeconds;
+
+    BackgroundLoop checkpointThread;
+
+public:
+    WalCheckpointer(const std::string &fileName, int intervalSeconds);
+
+    ~WalCheckpointer();
+
+private:
+    void checkpointLoop(std::unique_lock<std::mutex> &waitLock);
+
+    void checkpoint();
+};
+
+#endif //RASPBERRY_WALCHECKPOINTER_H
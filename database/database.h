@@ -4,9 +4,9 @@
 #include "parkingspaces.pb.h"
 
 /**
- * The time for reservations to expire, in minutes
+ * The time for reservations to expire, in minutes (Must match SELECT_EXPIRED_RESERVATIONS in the SQLDatabase)
  */
-#define RESERVATION_EXPIRATION 1
+#define RESERVATION_EXPIRATION 45
 
 class SpaceState {
 
@@ -17,9 +17,15 @@ private:
 
     std::string section, occupant;
 
+    /**
+     * The time of the last state change, in seconds since the epoch
+     */
+    int64_t lastChange;
+
 public:
-    SpaceState(int spaceId, parkingspaces::SpaceStates state, const std::string &section, const std::string &occupant) : spaceID(
-            spaceId), state(state), section(section), occupant(occupant) {}
+    SpaceState(int spaceId, parkingspaces::SpaceStates state, const std::string &section, const std::string &occupant,
+               int64_t lastChange = 0) : spaceID(
+            spaceId), state(state), section(section), occupant(occupant), lastChange(lastChange) {}
 
 public:
     int getSpaceId() const {
@@ -37,6 +43,26 @@ public:
     const std::string &getOccupant() const {
         return occupant;
     }
+
+    int64_t getLastChange() const {
+        return lastChange;
+    }
+};
+
+/**
+ * A change to the state of a space, to be applied in a batch
+ */
+struct SpaceUpdate {
+    unsigned int spaceID;
+
+    parkingspaces::SpaceStates state;
+
+    std::string licensePlate;
+
+    /**
+     * The section the space is inserted in, if it does not exist yet
+     */
+    std::string section;
 };
 
 class Database {
@@ -77,6 +103,16 @@ public:
 
     virtual bool updateSpacePlate(unsigned int spaceID, const std::string &licensePlate) = 0;
 
+    /**
+     * Apply a batch of state updates as a single transaction, inserting the spaces that do not exist yet
+     *
+     * @param updates
+     * @return The state of each space before its update, in the same order as the updates
+     *  (For the spaces that were inserted, the state they were inserted with). Empty when the transaction failed and
+     *  none of the updates were applied
+     */
+    virtual std::vector<SpaceState> applySpaceUpdates(const std::vector<SpaceUpdate> &updates) = 0;
+
     /**
      * Get the reservation for a license plate
      * @param licensePlate
@@ -0,0 +1,310 @@
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+
+static const char *levelNames[] = {"debug", "info", "warn", "error"};
+
+LogField::LogField(const char *key, const char *value) : key(key), type(STRING),
+                                                         length(value == nullptr ? 0 : strlen(value)) {
+    this->value.s = value;
+}
+
+LogBuffer::LogBuffer() : records(LOG_BUFFER_RECORDS), head(0), tail(0), retired(false) {}
+
+LogRecord *LogBuffer::claim() {
+
+    uint64_t position = tail.load(std::memory_order_relaxed);
+
+    if (position - head.load(std::memory_order_acquire) >= records.size()) return nullptr;
+
+    return &records[position & (records.size() - 1)];
+}
+
+void LogBuffer::commit() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void LogBuffer::drain(std::vector<LogRecord> &out) {
+
+    uint64_t position = head.load(std::memory_order_relaxed);
+
+    uint64_t end = tail.load(std::memory_order_acquire);
+
+    for (; position < end; position++) {
+        out.push_back(records[position & (records.size() - 1)]);
+    }
+
+    //The thread can reuse the records from here on
+    head.store(end, std::memory_order_release);
+}
+
+/**
+ * Marks the buffer of a thread as retired when the thread exits
+ */
+struct ThreadBuffer {
+    std::shared_ptr<LogBuffer> buffer;
+
+    ~ThreadBuffer() {
+        if (buffer) buffer->retire();
+    }
+};
+
+Logger::Logger(FILE *out) : dropped(0), urgent(false), running(true), out(out) {
+    this->batch.reserve(LOG_BUFFER_RECORDS);
+
+    this->flushThread = std::thread(&Logger::flushLoop, this);
+}
+
+Logger::~Logger() {
+
+    {
+        std::unique_lock<std::mutex> stopLock(this->lock);
+
+        this->running = false;
+    }
+
+    this->condition.notify_all();
+
+    if (this->flushThread.joinable()) {
+        this->flushThread.join();
+    }
+}
+
+Logger &Logger::instance() {
+    static Logger logger;
+
+    return logger;
+}
+
+LogBuffer &Logger::threadBuffer() {
+
+    static thread_local ThreadBuffer local;
+
+    if (!local.buffer) {
+        local.buffer = std::make_shared<LogBuffer>();
+
+        std::unique_lock<std::mutex> acqLock(this->lock);
+
+        this->buffers.push_back(local.buffer);
+    }
+
+    return *local.buffer;
+}
+
+void Logger::log(int level, const char *message, const LogField &first, const LogField &second,
+                 const LogField &third, const LogField &fourth) {
+
+    LogBuffer &buffer = threadBuffer();
+
+    LogRecord *record = buffer.claim();
+
+    if (record == nullptr) {
+        this->dropped++;
+
+        return;
+    }
+
+    record->timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    record->level = level;
+    record->message = message;
+    record->fieldCount = 0;
+
+    for (const LogField *field : {&first, &second, &third, &fourth}) {
+        if (field->type == LogField::NONE) continue;
+
+        LogRecord::Field &copy = record->fields[record->fieldCount++];
+
+        copy.key = field->key;
+        copy.type = field->type;
+
+        if (field->type == LogField::STRING) {
+            copy.length = std::min(field->length, (size_t) LOG_STRING_FIELD);
+
+            memcpy(copy.value.s, field->value.s, copy.length);
+        } else {
+            copy.length = 0;
+
+            memcpy(&copy.value, &field->value, sizeof(field->value));
+        }
+    }
+
+    buffer.commit();
+
+    if (level >= LOG_LEVEL_WARN) {
+        //Warnings and errors don't wait for the interval
+        this->urgent.store(true);
+
+        this->condition.notify_one();
+    }
+}
+
+void Logger::flushLoop() {
+
+    std::unique_lock<std::mutex> waitLock(this->lock);
+
+    while (this->running) {
+
+        this->condition.wait_for(waitLock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS),
+                                 [this]() { return !this->running || this->urgent.load(); });
+
+        this->urgent.store(false);
+
+        waitLock.unlock();
+
+        flush();
+
+        waitLock.lock();
+    }
+
+    waitLock.unlock();
+
+    //Whatever was logged while we were stopping
+    flush();
+}
+
+void Logger::flush() {
+
+    {
+        std::unique_lock<std::mutex> acqLock(this->lock);
+
+        for (auto it = this->buffers.begin(); it != this->buffers.end();) {
+            //Checked before draining, so a retired buffer has nothing left after it
+            bool retired = (*it)->isRetired();
+
+            (*it)->drain(this->batch);
+
+            if (retired) {
+                it = this->buffers.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    uint64_t lost = this->dropped.exchange(0);
+
+    if (this->batch.empty() && lost == 0) return;
+
+    //The threads are drained one after the other, their records are put back in the order they were logged
+    std::stable_sort(this->batch.begin(), this->batch.end(), [](const LogRecord &a, const LogRecord &b) {
+        return a.timeNs < b.timeNs;
+    });
+
+    this->output.clear();
+
+    for (const auto &record : this->batch) {
+        format(record);
+    }
+
+    if (lost > 0) {
+        this->output += "level=warn msg=\"Dropped log records, the buffer was full\" count=";
+        this->output += std::to_string(lost);
+        this->output += '\n';
+    }
+
+    this->batch.clear();
+
+    fwrite(this->output.data(), 1, this->output.size(), this->out);
+    fflush(this->out);
+}
+
+/**
+ * Append a string as a logfmt value, quoted when it has to be
+ */
+static void appendValue(std::string &output, const char *value, size_t length) {
+
+    bool quote = length == 0 || std::any_of(value, value + length, [](char c) {
+        return c == ' ' || c == '=' || c == '"' || c == '\\' || (unsigned char) c < 0x20;
+    });
+
+    if (!quote) {
+        output.append(value, length);
+
+        return;
+    }
+
+    output += '"';
+
+    for (size_t i = 0; i < length; i++) {
+        char c = value[i];
+
+        if (c == '"' || c == '\\') {
+            output += '\\';
+            output += c;
+        } else if (c == '\n') {
+            output += "\\n";
+        } else if ((unsigned char) c < 0x20) {
+            output += ' ';
+        } else {
+            output += c;
+        }
+    }
+
+    output += '"';
+}
+
+void Logger::format(const LogRecord &record) {
+
+    char time[64];
+
+    time_t seconds = record.timeNs / 1000000000;
+
+    struct tm utc{};
+
+    gmtime_r(&seconds, &utc);
+
+    size_t length = strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+
+    snprintf(time + length, sizeof(time) - length, ".%03dZ", (int) (record.timeNs / 1000000 % 1000));
+
+    this->output += "ts=";
+    this->output += time;
+    this->output += " level=";
+    this->output += levelNames[std::max(LOG_LEVEL_DEBUG, std::min(record.level, LOG_LEVEL_ERROR))];
+    this->output += " msg=";
+
+    appendValue(this->output, record.message, strlen(record.message));
+
+    char number[32];
+
+    for (int i = 0; i < record.fieldCount; i++) {
+        const LogRecord::Field &field = record.fields[i];
+
+        this->output += ' ';
+        this->output += field.key;
+        this->output += '=';
+
+        switch (field.type) {
+            case LogField::INT:
+                snprintf(number, sizeof(number), "%" PRId64, field.value.i);
+                this->output += number;
+                break;
+            case LogField::UINT:
+                snprintf(number, sizeof(number), "%" PRIu64, field.value.u);
+                this->output += number;
+                break;
+            case LogField::DOUBLE:
+                snprintf(number, sizeof(number), "%g", field.value.d);
+                this->output += number;
+                break;
+            case LogField::BOOL:
+                this->output += field.value.b ? "true" : "false";
+                break;
+            case LogField::POINTER:
+                snprintf(number, sizeof(number), "%p", field.value.p);
+                this->output += number;
+                break;
+            case LogField::STRING:
+                appendValue(this->output, field.value.s, field.length);
+                break;
+            default:
+                break;
+        }
+    }
+
+    this->output += '\n';
+}
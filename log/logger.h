@@ -0,0 +1,263 @@
+#ifndef RASPBERRY_LOGGER_H
+#define RASPBERRY_LOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+/**
+ * The lowest level that is compiled in, the calls below it are removed along with the evaluation of their fields.
+ * Release builds (NDEBUG) leave the debug chatter out, define it to override
+ */
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+/**
+ * The records each thread can have waiting for the flusher (Must be a power of 2), the ones that don't fit are dropped
+ */
+#define LOG_BUFFER_RECORDS 1024
+
+#define LOG_FLUSH_INTERVAL_MS 100
+
+#define LOG_MAX_FIELDS 4
+
+/**
+ * The bytes of a string field that are kept, the rest is cut off
+ */
+#define LOG_STRING_FIELD 48
+
+/**
+ * Log a message (Which must be a string literal) with up to LOG_MAX_FIELDS fields, as in:
+ *
+ * LOG_INFO("Applying snapshot", {"spaces", readings.size()}, {"changed", updates.size()});
+ */
+#define LOG_AT(level, ...) do { if ((level) >= LOG_MIN_LEVEL) Logger::instance().log((level), __VA_ARGS__); } while (false)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * A key (A string literal) and its value. The value is only read while the call to log lasts
+ */
+struct LogField {
+
+    enum Type : uint8_t {
+        NONE, INT, UINT, DOUBLE, BOOL, POINTER, STRING
+    };
+
+    const char *key;
+
+    Type type;
+
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        bool b;
+        const void *p;
+        const char *s;
+    } value;
+
+    size_t length;
+
+    LogField() : key(nullptr), type(NONE), value{0}, length(0) {}
+
+    LogField(const char *key, int value) : LogField(key, (long long) value) {}
+
+    LogField(const char *key, long value) : LogField(key, (long long) value) {}
+
+    LogField(const char *key, long long value) : key(key), type(INT), length(0) {
+        this->value.i = value;
+    }
+
+    LogField(const char *key, unsigned value) : LogField(key, (unsigned long long) value) {}
+
+    LogField(const char *key, unsigned long value) : LogField(key, (unsigned long long) value) {}
+
+    LogField(const char *key, unsigned long long value) : key(key), type(UINT), length(0) {
+        this->value.u = value;
+    }
+
+    LogField(const char *key, double value) : key(key), type(DOUBLE), length(0) {
+        this->value.d = value;
+    }
+
+    LogField(const char *key, bool value) : key(key), type(BOOL), length(0) {
+        this->value.b = value;
+    }
+
+    LogField(const char *key, const void *value) : key(key), type(POINTER), length(0) {
+        this->value.p = value;
+    }
+
+    LogField(const char *key, const char *value);
+
+    LogField(const char *key, const std::string &value) : key(key), type(STRING), length(value.size()) {
+        this->value.s = value.data();
+    }
+};
+
+/**
+ * A log call as it waits in the buffer of its thread, the strings are copied into it
+ */
+struct LogRecord {
+
+    struct Field {
+        const char *key;
+
+        LogField::Type type;
+
+        uint8_t length;
+
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            bool b;
+            const void *p;
+            char s[LOG_STRING_FIELD];
+        } value;
+    };
+
+    uint64_t timeNs;
+
+    int level;
+
+    const char *message;
+
+    int fieldCount;
+
+    Field fields[LOG_MAX_FIELDS];
+};
+
+/**
+ * The records of a single thread. Only that thread writes to it and only the flusher reads from it, so neither of them
+ * takes a lock
+ */
+class LogBuffer {
+
+private:
+    std::vector<LogRecord> records;
+
+    /**
+     * The next record the flusher reads and the next one the thread writes (Not wrapped around the ring)
+     */
+    std::atomic<uint64_t> head, tail;
+
+    std::atomic_bool retired;
+
+public:
+    LogBuffer();
+
+    /**
+     * @return nullptr when the buffer is full
+     */
+    LogRecord *claim();
+
+    void commit();
+
+    /**
+     * Move the records that were committed to the end of out
+     */
+    void drain(std::vector<LogRecord> &out);
+
+    /**
+     * The thread has exited, the buffer is dropped once it's drained
+     */
+    void retire() {
+        retired.store(true);
+    }
+
+    bool isRetired() const {
+        return retired.load();
+    }
+};
+
+/**
+ * Asynchronous structured logger.
+ *
+ * A log call only copies its message and fields into a ring buffer of its own thread, the records of every thread are
+ * formatted (As logfmt lines) and written out by a background thread, every LOG_FLUSH_INTERVAL_MS or as soon as a
+ * warning or an error comes in. So logging never makes the threads wait on stdout, or on each other.
+ */
+class Logger {
+
+private:
+    std::vector<std::shared_ptr<LogBuffer>> buffers;
+
+    /**
+     * The records dropped because the buffer of their thread was full
+     */
+    std::atomic<uint64_t> dropped;
+
+    std::atomic_bool urgent;
+
+    bool running;
+
+    /**
+     * Guards the list of buffers and running
+     */
+    std::mutex lock;
+
+    std::condition_variable condition;
+
+    /**
+     * Only used by the flusher (Or the destructor once it's done), reused between flushes
+     */
+    std::vector<LogRecord> batch;
+
+    std::string output;
+
+    FILE *out;
+
+    std::thread flushThread;
+
+public:
+    explicit Logger(FILE *out = stdout);
+
+    /**
+     * Writes out what is left in the buffers
+     */
+    ~Logger();
+
+    static Logger &instance();
+
+    void log(int level, const char *message, const LogField &first = LogField(), const LogField &second = LogField(),
+             const LogField &third = LogField(), const LogField &fourth = LogField());
+
+    uint64_t getDropped() const {
+        return dropped.load();
+    }
+
+private:
+    LogBuffer &threadBuffer();
+
+    void flushLoop();
+
+    /**
+     * Write out the records of every buffer, in the order they were logged
+     */
+    void flush();
+
+    void format(const LogRecord &record);
+};
+
+#endif //RASPBERRY_LOGGER_H
@@ -1,10 +1,17 @@
 #include <iostream>
 #include "conn_arduino/firebase_notifications.h"
 #include "server/server.h"
-#include "database/SQLDatabase.h"
+#include "database/MemoryDatabase.h"
+#include "metrics/metricsserver.h"
 
 int main() {
-    auto database = std::make_shared<SQLDatabase>();
+    //Every read is answered from memory (The SQL database is only read once, to load it), so the reader connections
+    //would sit idle
+    SQLProfile backingProfile;
+
+    backingProfile.readerConnections = 0;
+
+    auto database = std::make_shared<MemoryDatabase>(std::make_shared<SQLDatabase>(DB_FILE_NAME, backingProfile));
 
     auto arduino_conn = std::make_shared<FirebaseNotifications>();
 
@@ -14,6 +21,8 @@ int main() {
 
     arduino_conn->notifyArduino(2, true);
 
+    MetricsServer metricsServer;
+
     sv->wait();
 
     return 0;
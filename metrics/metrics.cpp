@@ -0,0 +1,318 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+
+/**
+ * The bits below the leading one that pick the sub bucket
+ */
+static const int SUB_BUCKET_BITS = __builtin_ctz(HISTOGRAM_SUB_BUCKETS);
+
+Histogram::Histogram() : sumNs(0) {
+    for (auto &bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+int Histogram::bucketFor(uint64_t ns) {
+
+    if (ns < (1ull << HISTOGRAM_MIN_EXPONENT)) return 0;
+
+    int exponent = 63 - __builtin_clzll(ns);
+
+    if (exponent >= HISTOGRAM_MAX_EXPONENT) return HISTOGRAM_BUCKETS;
+
+    int sub = (ns >> (exponent - SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+
+    return 1 + (exponent - HISTOGRAM_MIN_EXPONENT) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+uint64_t Histogram::upperBound(int bucket) {
+
+    if (bucket == 0) return 1ull << HISTOGRAM_MIN_EXPONENT;
+
+    int exponent = HISTOGRAM_MIN_EXPONENT + (bucket - 1) / HISTOGRAM_SUB_BUCKETS;
+
+    uint64_t sub = (bucket - 1) % HISTOGRAM_SUB_BUCKETS;
+
+    return (HISTOGRAM_SUB_BUCKETS + sub + 1) << (exponent - SUB_BUCKET_BITS);
+}
+
+void Histogram::record(uint64_t ns) {
+    buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+
+    sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::getCount() const {
+
+    uint64_t count = 0;
+
+    for (const auto &bucket : buckets) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+
+    return count;
+}
+
+uint64_t Histogram::quantile(double q) const {
+
+    uint64_t count = getCount();
+
+    if (count == 0) return 0;
+
+    auto rank = (uint64_t) std::ceil(q * count);
+
+    uint64_t seen = 0;
+
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += getBucket(bucket);
+
+        if (seen >= rank && seen > 0) return upperBound(bucket);
+    }
+
+    return UINT64_MAX;
+}
+
+void RateMeter::mark(uint64_t events) {
+
+    int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    Slot &slot = slots[second % (RATE_WINDOW_S + 1)];
+
+    int64_t seen = slot.second.load(std::memory_order_acquire);
+
+    //The first event of the second takes the slot over from the second it was last used for
+    if (seen != second && slot.second.compare_exchange_strong(seen, second)) {
+        slot.count.store(0, std::memory_order_relaxed);
+    }
+
+    slot.count.fetch_add(events, std::memory_order_relaxed);
+}
+
+double RateMeter::perSecond() const {
+
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    uint64_t events = 0;
+
+    //The current second isn't over yet, so it's left out
+    for (const auto &slot : slots) {
+        int64_t second = slot.second.load(std::memory_order_acquire);
+
+        if (second < now && second >= now - RATE_WINDOW_S) {
+            events += slot.count.load(std::memory_order_relaxed);
+        }
+    }
+
+    return (double) events / RATE_WINDOW_S;
+}
+
+Metrics &Metrics::instance() {
+    static Metrics metrics;
+
+    return metrics;
+}
+
+Metrics::Series &Metrics::seriesFor(const std::string &name, const std::string &help, MetricType type,
+                                   const std::string &labels) {
+
+    auto family = this->families.find(name);
+
+    if (family == this->families.end()) {
+        family = this->families.emplace(name, Family{help, type, {}}).first;
+    }
+
+    for (const auto &series : family->second.series) {
+        if (series->labels == labels) return *series;
+    }
+
+    family->second.series.push_back(std::make_unique<Series>());
+
+    Series &series = *family->second.series.back();
+
+    series.labels = labels;
+    series.owner = nullptr;
+
+    return series;
+}
+
+Counter &Metrics::counter(const std::string &name, const std::string &help, const std::string &labels) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    Series &series = seriesFor(name, help, MetricType::COUNTER, labels);
+
+    if (!series.counter) series.counter = std::make_unique<Counter>();
+
+    return *series.counter;
+}
+
+Gauge &Metrics::gauge(const std::string &name, const std::string &help, const std::string &labels) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    Series &series = seriesFor(name, help, MetricType::GAUGE, labels);
+
+    if (!series.gauge) series.gauge = std::make_unique<Gauge>();
+
+    return *series.gauge;
+}
+
+Histogram &Metrics::histogram(const std::string &name, const std::string &help, const std::string &labels) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    Series &series = seriesFor(name, help, MetricType::HISTOGRAM, labels);
+
+    if (!series.histogram) series.histogram = std::make_unique<Histogram>();
+
+    return *series.histogram;
+}
+
+RateMeter &Metrics::rate(const std::string &name, const std::string &help, const std::string &labels) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    Series &series = seriesFor(name, help, MetricType::GAUGE, labels);
+
+    if (!series.rate) series.rate = std::make_unique<RateMeter>();
+
+    return *series.rate;
+}
+
+void Metrics::observe(const std::string &name, const std::string &help, MetricType type,
+                      std::function<double()> read, const void *owner, const std::string &labels) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    Series &series = seriesFor(name, help, type, labels);
+
+    series.read = std::move(read);
+    series.owner = owner;
+}
+
+void Metrics::removeObserved(const void *owner) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    for (auto family = this->families.begin(); family != this->families.end();) {
+        auto &series = family->second.series;
+
+        series.erase(std::remove_if(series.begin(), series.end(), [owner](const std::unique_ptr<Series> &other) {
+            return other->read && other->owner == owner;
+        }), series.end());
+
+        if (series.empty()) {
+            family = this->families.erase(family);
+        } else {
+            family++;
+        }
+    }
+}
+
+static const char *typeName(MetricType type) {
+    switch (type) {
+        case MetricType::COUNTER:
+            return "counter";
+        case MetricType::HISTOGRAM:
+            return "histogram";
+        default:
+            return "gauge";
+    }
+}
+
+static void appendNumber(std::string &output, double value) {
+
+    char number[32];
+
+    if (std::isnan(value)) {
+        output += "NaN";
+    } else if (value == std::floor(value) && std::fabs(value) < 1e15) {
+        snprintf(number, sizeof(number), "%" PRId64, (int64_t) value);
+        output += number;
+    } else {
+        snprintf(number, sizeof(number), "%.9g", value);
+        output += number;
+    }
+}
+
+/**
+ * Append a sample line, the labels of the series go before the extra ones (The le of a bucket)
+ */
+static void appendSample(std::string &output, const std::string &name, const std::string &labels,
+                         const std::string &extra, double value) {
+
+    output += name;
+
+    if (!labels.empty() || !extra.empty()) {
+        output += '{';
+        output += labels;
+
+        if (!labels.empty() && !extra.empty()) output += ',';
+
+        output += extra;
+        output += '}';
+    }
+
+    output += ' ';
+
+    appendNumber(output, value);
+
+    output += '\n';
+}
+
+static void appendHistogram(std::string &output, const std::string &name, const std::string &labels,
+                            const Histogram &histogram) {
+
+    uint64_t cumulative = 0;
+
+    char bound[48];
+
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        cumulative += histogram.getBucket(bucket);
+
+        snprintf(bound, sizeof(bound), "le=\"%.9g\"", Histogram::upperBound(bucket) / 1e9);
+
+        appendSample(output, name + "_bucket", labels, bound, cumulative);
+    }
+
+    cumulative += histogram.getBucket(HISTOGRAM_BUCKETS);
+
+    appendSample(output, name + "_bucket", labels, "le=\"+Inf\"", cumulative);
+    appendSample(output, name + "_sum", labels, "", histogram.getSumNs() / 1e9);
+    appendSample(output, name + "_count", labels, "", cumulative);
+}
+
+std::string Metrics::expose() {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    std::string output;
+
+    for (const auto &family : this->families) {
+        const std::string &name = family.first;
+
+        output += "# HELP " + name + " " + family.second.help + "\n";
+        output += "# TYPE " + name + " " + typeName(family.second.type) + "\n";
+
+        for (const auto &series : family.second.series) {
+            if (series->histogram) {
+                appendHistogram(output, name, series->labels, *series->histogram);
+            } else if (series->counter) {
+                appendSample(output, name, series->labels, "", series->counter->get());
+            } else if (series->gauge) {
+                appendSample(output, name, series->labels, "", series->gauge->get());
+            } else if (series->rate) {
+                appendSample(output, name, series->labels, "", series->rate->perSecond());
+            } else if (series->read) {
+                appendSample(output, name, series->labels, "", series->read());
+            }
+        }
+    }
+
+    return output;
+}
@@ -0,0 +1,245 @@
+#ifndef RASPBERRY_METRICS_H
+#define RASPBERRY_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The histograms record latencies from 2^HISTOGRAM_MIN_EXPONENT ns (~1 µs, anything below is in the first bucket)
+ * to 2^HISTOGRAM_MAX_EXPONENT ns (~34 s, anything above is only in +Inf)
+ */
+#define HISTOGRAM_MIN_EXPONENT 10
+#define HISTOGRAM_MAX_EXPONENT 35
+
+/**
+ * Every power of 2 is split in this many buckets (Must be a power of 2), so a bucket is at most ~19% wide
+ */
+#define HISTOGRAM_SUB_BUCKETS 4
+
+#define HISTOGRAM_BUCKETS (1 + (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_MIN_EXPONENT) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * The seconds the events per second are averaged over
+ */
+#define RATE_WINDOW_S 10
+
+class Counter {
+
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    void increment(uint64_t by = 1) {
+        value.fetch_add(by, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+class Gauge {
+
+private:
+    std::atomic<int64_t> value{0};
+
+public:
+    void add(int64_t by) {
+        value.fetch_add(by, std::memory_order_relaxed);
+    }
+
+    void set(int64_t to) {
+        value.store(to, std::memory_order_relaxed);
+    }
+
+    int64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * A latency histogram with log-linear buckets (Like an HDR histogram with 2 significant bits): the buckets are
+ * HISTOGRAM_SUB_BUCKETS to every power of 2, so the error is relative to the latency instead of fixed, with a few
+ * dozen buckets from microseconds to seconds.
+ *
+ * Recording is a couple of relaxed atomic increments, no locks.
+ */
+class Histogram {
+
+private:
+    /**
+     * The last one holds the latencies above the largest bucket
+     */
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS + 1];
+
+    std::atomic<uint64_t> sumNs;
+
+public:
+    Histogram();
+
+    void record(uint64_t ns);
+
+    void recordSince(std::chrono::steady_clock::time_point start) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    uint64_t getCount() const;
+
+    uint64_t getSumNs() const {
+        return sumNs.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getBucket(int bucket) const {
+        return buckets[bucket].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The latencies in a bucket are below this many ns
+     */
+    static uint64_t upperBound(int bucket);
+
+    static int bucketFor(uint64_t ns);
+
+    /**
+     * An estimate of a quantile (0 to 1) of the latencies, in ns: the upper bound of the bucket it falls in
+     */
+    uint64_t quantile(double q) const;
+};
+
+/**
+ * Records the time from its creation to the end of its scope
+ */
+class ScopedTimer {
+
+private:
+    Histogram &histogram;
+
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedTimer(Histogram &histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+    ScopedTimer(const ScopedTimer &) = delete;
+
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    ~ScopedTimer() {
+        histogram.recordSince(start);
+    }
+};
+
+/**
+ * The events per second, averaged over the last RATE_WINDOW_S complete seconds.
+ *
+ * The events are counted in a slot for every second, which is reset by the first event of the second it's reused for.
+ * An event that races with the reset can be lost, which only makes the rate a little off
+ */
+class RateMeter {
+
+private:
+    struct Slot {
+        std::atomic<int64_t> second{-1};
+
+        std::atomic<uint64_t> count{0};
+    };
+
+    Slot slots[RATE_WINDOW_S + 1];
+
+public:
+    void mark(uint64_t events = 1);
+
+    double perSecond() const;
+};
+
+enum class MetricType {
+    COUNTER, GAUGE, HISTOGRAM
+};
+
+/**
+ * The metrics of the server, exposed in the Prometheus text format.
+ *
+ * A metric is registered once by name (And labels, as in op="insert") and kept for the life of the process, the hot
+ * paths hold on to the reference and never touch the registry again. Registering the same name and labels again
+ * returns the same metric.
+ *
+ * Values that are already kept somewhere else (The size of a subscriber list, the stats of the call pool) are
+ * observed instead: they're read when the metrics are exposed, and removed with their owner
+ */
+class Metrics {
+
+private:
+    struct Series {
+        std::string labels;
+
+        std::unique_ptr<Counter> counter;
+
+        std::unique_ptr<Gauge> gauge;
+
+        std::unique_ptr<Histogram> histogram;
+
+        std::unique_ptr<RateMeter> rate;
+
+        std::function<double()> read;
+
+        const void *owner;
+    };
+
+    struct Family {
+        std::string help;
+
+        MetricType type;
+
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    std::map<std::string, Family> families;
+
+    std::mutex lock;
+
+public:
+    static Metrics &instance();
+
+    Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    Gauge &gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    Histogram &histogram(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    /**
+     * A gauge of the events per second
+     */
+    RateMeter &rate(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    /**
+     * Expose a value that is read from its owner
+     */
+    void observe(const std::string &name, const std::string &help, MetricType type, std::function<double()> read,
+                 const void *owner, const std::string &labels = "");
+
+    /**
+     * Stop exposing the values of an owner, before it's freed
+     */
+    void removeObserved(const void *owner);
+
+    /**
+     * Every metric in the Prometheus text format
+     */
+    std::string expose();
+
+private:
+    /**
+     * The series of a name and labels, created if it doesn't exist yet. The lock must be held
+     */
+    Series &seriesFor(const std::string &name, const std::string &help, MetricType type, const std::string &labels);
+};
+
+#endif //RASPBERRY_METRICS_H
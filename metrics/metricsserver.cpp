@@ -0,0 +1,132 @@
+#include "metricsserver.h"
+#include "metrics.h"
+#include "../log/logger.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * How often the server checks whether it's stopping while no scrape comes in
+ */
+#define METRICS_POLL_MS 500
+
+#define METRICS_MAX_REQUEST 8192
+
+MetricsServer::MetricsServer(int port, const std::string &address) : listener(-1), running(true) {
+
+    this->listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (this->listener < 0) {
+        LOG_ERROR("Failed to create the metrics socket", {"error", strerror(errno)});
+
+        return;
+    }
+
+    int reuse = 1;
+
+    setsockopt(this->listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in bindAddress{};
+
+    bindAddress.sin_family = AF_INET;
+    bindAddress.sin_port = htons(port);
+
+    inet_pton(AF_INET, address.c_str(), &bindAddress.sin_addr);
+
+    if (bind(this->listener, (sockaddr *) &bindAddress, sizeof(bindAddress)) < 0 || listen(this->listener, 16) < 0) {
+        LOG_ERROR("Failed to listen for the metrics", {"address", address}, {"port", port},
+                  {"error", strerror(errno)});
+
+        close(this->listener);
+        this->listener = -1;
+
+        return;
+    }
+
+    LOG_INFO("Serving metrics", {"address", address}, {"port", port});
+
+    this->serverThread = std::thread(&MetricsServer::serveLoop, this);
+}
+
+MetricsServer::~MetricsServer() {
+
+    this->running = false;
+
+    if (this->serverThread.joinable()) {
+        this->serverThread.join();
+    }
+
+    if (this->listener >= 0) {
+        close(this->listener);
+    }
+}
+
+void MetricsServer::serveLoop() {
+
+    pollfd pollListener{this->listener, POLLIN, 0};
+
+    while (this->running) {
+
+        if (poll(&pollListener, 1, METRICS_POLL_MS) <= 0) continue;
+
+        int client = accept(this->listener, nullptr, nullptr);
+
+        if (client < 0) continue;
+
+        serve(client);
+
+        close(client);
+    }
+}
+
+static void sendAll(int client, const std::string &data) {
+
+    size_t sent = 0;
+
+    while (sent < data.size()) {
+        ssize_t written = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if (written <= 0) return;
+
+        sent += written;
+    }
+}
+
+void MetricsServer::serve(int client) {
+
+    timeval timeout{METRICS_READ_TIMEOUT_S, 0};
+
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+
+    char buffer[1024];
+
+    //Only the request line matters, but the whole head is read so the client doesn't get reset
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < METRICS_MAX_REQUEST) {
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+
+        if (received <= 0) return;
+
+        request.append(buffer, received);
+    }
+
+    std::string status, contentType, body;
+
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0) {
+        status = "200 OK";
+        contentType = "text/plain; version=0.0.4; charset=utf-8";
+        body = Metrics::instance().expose();
+    } else {
+        status = "404 Not Found";
+        contentType = "text/plain; charset=utf-8";
+        body = "Not found, the metrics are at /metrics\n";
+    }
+
+    sendAll(client, "HTTP/1.1 " + status + "\r\nContent-Type: " + contentType + "\r\nContent-Length: " +
+                    std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+}
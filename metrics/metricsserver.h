@@ -0,0 +1,52 @@
+#ifndef RASPBERRY_METRICSSERVER_H
+#define RASPBERRY_METRICSSERVER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+/**
+ * Only local scrapers by default, as the metrics have no auth. Deployments that scrape from another host define it
+ * (For example -DMETRICS_ADDRESS=\"0.0.0.0\")
+ */
+#ifndef METRICS_ADDRESS
+#define METRICS_ADDRESS "127.0.0.1"
+#endif
+
+#define METRICS_PORT 9464
+
+/**
+ * How long a scrape can take to send its request before it's dropped
+ */
+#define METRICS_READ_TIMEOUT_S 2
+
+/**
+ * Serves the metrics over HTTP at /metrics, in the Prometheus text format, from a thread of its own.
+ *
+ * The scrapes are served one at a time, which is all Prometheus needs
+ */
+class MetricsServer {
+
+private:
+    int listener;
+
+    std::atomic_bool running;
+
+    std::thread serverThread;
+
+public:
+    explicit MetricsServer(int port = METRICS_PORT, const std::string &address = METRICS_ADDRESS);
+
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer &) = delete;
+
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+private:
+    void serveLoop();
+
+    void serve(int client);
+};
+
+#endif //RASPBERRY_METRICSSERVER_H
@@ -0,0 +1,98 @@
+#include "callpool.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+
+#define CALL_POOL_CLASSES (CALL_POOL_MAX_BLOCK / CALL_POOL_GRANULARITY)
+
+namespace {
+
+    /**
+     * The free blocks of a class are linked through their first bytes
+     */
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct SizeClass {
+        std::mutex lock;
+
+        FreeBlock *free = nullptr;
+
+        size_t freeCount = 0;
+    };
+
+    SizeClass sizeClasses[CALL_POOL_CLASSES];
+
+    std::atomic<uint64_t> heapAllocations{0}, reused{0}, pooled{0}, heapFrees{0};
+
+    size_t classOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / CALL_POOL_GRANULARITY;
+    }
+}
+
+void *CallPool::allocate(size_t size) {
+
+    if (size > CALL_POOL_MAX_BLOCK) {
+        heapAllocations++;
+
+        return ::operator new(size);
+    }
+
+    size_t index = classOf(size);
+
+    SizeClass &sizeClass = sizeClasses[index];
+
+    {
+        std::unique_lock<std::mutex> acqLock(sizeClass.lock);
+
+        if (sizeClass.free != nullptr) {
+            FreeBlock *block = sizeClass.free;
+
+            sizeClass.free = block->next;
+            sizeClass.freeCount--;
+
+            reused++;
+            pooled--;
+
+            return block;
+        }
+    }
+
+    heapAllocations++;
+
+    //Every block of a class has the same size, so any of them can serve any request of the class
+    return ::operator new((index + 1) * CALL_POOL_GRANULARITY);
+}
+
+void CallPool::release(void *block, size_t size) {
+
+    if (block == nullptr) return;
+
+    if (size <= CALL_POOL_MAX_BLOCK) {
+        SizeClass &sizeClass = sizeClasses[classOf(size)];
+
+        std::unique_lock<std::mutex> acqLock(sizeClass.lock);
+
+        if (sizeClass.freeCount < CALL_POOL_MAX_FREE) {
+            auto freeBlock = static_cast<FreeBlock *>(block);
+
+            freeBlock->next = sizeClass.free;
+
+            sizeClass.free = freeBlock;
+            sizeClass.freeCount++;
+
+            pooled++;
+
+            return;
+        }
+    }
+
+    heapFrees++;
+
+    ::operator delete(block);
+}
+
+CallPool::Stats CallPool::getStats() {
+    return {heapAllocations.load(), reused.load(), pooled.load(), heapFrees.load()};
+}
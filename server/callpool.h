@@ -0,0 +1,78 @@
+#ifndef RASPBERRY_CALLPOOL_H
+#define RASPBERRY_CALLPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The blocks are pooled in classes of this many bytes
+ */
+#define CALL_POOL_GRANULARITY 64
+
+/**
+ * Bigger blocks go straight to the heap
+ */
+#define CALL_POOL_MAX_BLOCK 8192
+
+/**
+ * The number of free blocks kept in each class, the ones above it are given back to the heap so a reconnect storm
+ * doesn't keep its memory forever
+ */
+#define CALL_POOL_MAX_FREE 4096
+
+/**
+ * Free lists of the blocks the calls (And their message queues) are made of.
+ *
+ * Reconnecting clients free a call and accept a new one of the same type over and over, so a freed block is kept to be
+ * handed to the next call of the same size instead of going back to the allocator.
+ */
+class CallPool {
+
+public:
+    struct Stats {
+        /**
+         * The blocks taken from the heap and the ones handed out again from the free lists
+         */
+        uint64_t heapAllocations, reused;
+
+        /**
+         * The blocks in the free lists right now (Across every class) and the ones given back to the heap
+         */
+        uint64_t pooled, heapFrees;
+    };
+
+    static void *allocate(size_t size);
+
+    static void release(void *block, size_t size);
+
+    static Stats getStats();
+};
+
+/**
+ * Allocator for the containers of the calls, backed by the call pool
+ */
+template<typename T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    PoolAllocator() = default;
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(CallPool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *block, size_t n) {
+        CallPool::release(block, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U> &) const { return true; }
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U> &) const { return false; }
+};
+
+#endif //RASPBERRY_CALLPOOL_H
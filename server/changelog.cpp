@@ -0,0 +1,78 @@
+#include "changelog.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+ChangeLog::ChangeLog(size_t capacity) : capacity(capacity), version(0) {
+    this->changes.reserve(capacity);
+
+    this->epoch = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint64_t ChangeLog::record(const parkingspaces::ParkingSpaceStatus &status) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    this->version++;
+
+    if (this->changes.size() < this->capacity) {
+        this->changes.push_back({this->version, status});
+    } else {
+        Change &slot = this->changes[(this->version - 1) % this->capacity];
+
+        slot.version = this->version;
+        slot.status.CopyFrom(status);
+    }
+
+    return this->version;
+}
+
+bool ChangeLog::changesSince(uint64_t clientEpoch, uint64_t since,
+                             std::vector<parkingspaces::ParkingSpaceStatus> &result,
+                             std::atomic<uint64_t> &syncedVersion) const {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    syncedVersion.store(this->version);
+
+    if (clientEpoch != this->epoch || since > this->version) return false;
+
+    if (since == this->version) return true;
+
+    uint64_t oldest = this->version - this->changes.size() + 1;
+
+    //The first change the client is missing has already been dropped
+    if (oldest > since + 1) return false;
+
+    std::unordered_map<int, size_t> latest;
+
+    for (uint64_t current = since + 1; current <= this->version; current++) {
+
+        const Change &change = this->changes[(current - 1) % this->capacity];
+
+        //Alarms are never replaced, nor do they replace the state before them
+        if (change.status.firealarm()) {
+            result.push_back(change.status);
+
+            continue;
+        }
+
+        auto existing = latest.find(change.status.spaceid());
+
+        if (existing != latest.end()) {
+            //Only the latest state of the space is sent, in the place of its latest change
+            result[existing->second].set_spaceid(-1);
+        }
+
+        latest[change.status.spaceid()] = result.size();
+
+        result.push_back(change.status);
+    }
+
+    result.erase(std::remove_if(result.begin(), result.end(),
+                                [](const parkingspaces::ParkingSpaceStatus &status) { return status.spaceid() < 0; }),
+                 result.end());
+
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef RASPBERRY_CHANGELOG_H
+#define RASPBERRY_CHANGELOG_H
+
+#include "parkingspaces.pb.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * The number of changes kept, clients that fell further behind get a snapshot
+ */
+#define DEFAULT_CHANGE_LOG_SIZE 4096
+
+/**
+ * The latest changes of the parking spaces, each with a version that grows with every change.
+ *
+ * Clients that reconnect tell us the version they're at and only get the changes they missed, as long as they are
+ * still kept here. The versions restart with the server, so they come with an epoch (The time the log was created)
+ * to tell the versions of different runs apart.
+ */
+class ChangeLog {
+
+private:
+    struct Change {
+        uint64_t version;
+
+        parkingspaces::ParkingSpaceStatus status;
+    };
+
+    /**
+     * A ring of the latest changes, the change of a version is at (version - 1) % capacity. The slots are reused, so
+     * once the ring is full a change is copied into the strings of the one it replaces instead of allocating its own
+     */
+    std::vector<Change> changes;
+
+    size_t capacity;
+
+    uint64_t epoch, version;
+
+    mutable std::mutex lock;
+
+public:
+    explicit ChangeLog(size_t capacity = DEFAULT_CHANGE_LOG_SIZE);
+
+    uint64_t getEpoch() const {
+        return epoch;
+    }
+
+    /**
+     * Record a change.
+     *
+     * Nothing is published under the lock of the log (The streams take it under the lock of their call when they
+     * sync), the caller publishes the change after and keeps the order of the versions itself
+     * @return The version of the change
+     */
+    uint64_t record(const parkingspaces::ParkingSpaceStatus &status);
+
+    /**
+     * The latest state of every space that changed after a version, in the order they last changed.
+     *
+     * The current version is stored in syncedVersion while the log is locked: every change published before it is
+     * part of the result and every change published after it has a higher version, so a stream that only takes the
+     * changes above syncedVersion misses or repeats none
+     * @return Whether the changes since that version are all still kept, when they are not (Or the epoch is of an
+     * older run) the client needs a snapshot instead
+     */
+    bool changesSince(uint64_t clientEpoch, uint64_t since, std::vector<parkingspaces::ParkingSpaceStatus> &result,
+                      std::atomic<uint64_t> &syncedVersion) const;
+};
+
+#endif //RASPBERRY_CHANGELOG_H
@@ -0,0 +1,48 @@
+#ifndef RASPBERRY_EVENTARENA_H
+#define RASPBERRY_EVENTARENA_H
+
+#include <google/protobuf/arena.h>
+#include <cstddef>
+
+/**
+ * The size of the block on the stack the messages of an event are built in, what doesn't fit goes to the heap
+ */
+#define EVENT_ARENA_BLOCK 2048
+
+/**
+ * An arena for the messages published for a single event (A space changing state, a reservation...), backed by a
+ * block on the stack of the thread that handles it. The messages and their strings are built in the block and freed
+ * all at once with it, so publishing an event doesn't go to the heap for them.
+ *
+ * The messages live as long as the arena, the subscribers that keep one past the publish take their own copy
+ */
+class EventArena {
+
+private:
+    alignas(std::max_align_t) char block[EVENT_ARENA_BLOCK];
+
+    google::protobuf::Arena arena;
+
+    static google::protobuf::ArenaOptions optionsFor(char *block) {
+        google::protobuf::ArenaOptions options;
+
+        options.initial_block = block;
+        options.initial_block_size = EVENT_ARENA_BLOCK;
+
+        return options;
+    }
+
+public:
+    EventArena() : arena(optionsFor(block)) {}
+
+    EventArena(const EventArena &) = delete;
+
+    EventArena &operator=(const EventArena &) = delete;
+
+    template<typename T>
+    T *create() {
+        return google::protobuf::Arena::CreateMessage<T>(&arena);
+    }
+};
+
+#endif //RASPBERRY_EVENTARENA_H
@@ -0,0 +1,115 @@
+#include "lotsnapshot.h"
+#include "parkingnotifications.h"
+#include <atomic>
+
+LotSnapshot::LotSnapshot(std::shared_ptr<Database> db) : db(std::move(db)) {}
+
+std::shared_ptr<const LotSnapshot::Messages> LotSnapshot::cached() const {
+    return std::atomic_load(&this->current);
+}
+
+std::shared_ptr<const LotSnapshot::Messages> LotSnapshot::get() {
+
+    auto messages = std::atomic_load(&this->current);
+
+    if (messages) return messages;
+
+    std::unique_lock<std::mutex> acqLock(this->writeLock);
+
+    //Another call may have brought it up to date while we waited
+    messages = std::atomic_load(&this->current);
+
+    if (messages) return messages;
+
+    if (this->latest) {
+        patch();
+    } else {
+        build();
+    }
+
+    std::atomic_store(&this->current, this->latest);
+
+    return this->latest;
+}
+
+void LotSnapshot::update(const parkingspaces::ParkingSpaceStatus &status) {
+
+    std::unique_lock<std::mutex> acqLock(this->writeLock);
+
+    //When it's not built the change will already be in the database when it is
+    if (!this->latest) return;
+
+    this->pending[status.spaceid()] = status;
+
+    std::atomic_store(&this->current, std::shared_ptr<const Messages>());
+}
+
+void LotSnapshot::invalidate() {
+
+    std::unique_lock<std::mutex> acqLock(this->writeLock);
+
+    this->latest.reset();
+    this->positions.clear();
+    this->pending.clear();
+
+    std::atomic_store(&this->current, std::shared_ptr<const Messages>());
+}
+
+void LotSnapshot::build() {
+
+    auto spaceStates = this->db->fetchAllSpaceStates();
+
+    auto messages = std::make_shared<Messages>();
+
+    messages->reserve(spaceStates->size());
+
+    this->positions.clear();
+
+    for (const auto &space : *spaceStates) {
+        this->positions[space.getSpaceId()] = messages->size();
+
+        messages->push_back(serializeSpace(space.getSpaceId(), space.getSection(), space.getState()));
+    }
+
+    //Whatever was pending was already in the database
+    this->pending.clear();
+
+    this->latest = std::move(messages);
+}
+
+void LotSnapshot::patch() {
+
+    //Only the references to the buffers are copied
+    auto messages = std::make_shared<Messages>(*this->latest);
+
+    for (const auto &change : this->pending) {
+        const auto &status = change.second;
+
+        auto message = serializeSpace(status.spaceid(), status.spacesection(), status.spacestate());
+
+        auto position = this->positions.find(status.spaceid());
+
+        if (position != this->positions.end()) {
+            (*messages)[position->second] = std::move(message);
+        } else {
+            this->positions[status.spaceid()] = messages->size();
+
+            messages->push_back(std::move(message));
+        }
+    }
+
+    this->pending.clear();
+
+    this->latest = std::move(messages);
+}
+
+grpc::ByteBuffer LotSnapshot::serializeSpace(int spaceID, const std::string &section,
+                                             parkingspaces::SpaceStates state) {
+    parkingspaces::ParkingSpaceStatus status;
+
+    status.set_spaceid(spaceID);
+    status.set_spacesection(section);
+    status.set_spacestate(state);
+
+    return serializeMessage(status);
+}
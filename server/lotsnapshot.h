@@ -0,0 +1,89 @@
+#ifndef RASPBERRY_LOTSNAPSHOT_H
+#define RASPBERRY_LOTSNAPSHOT_H
+
+#include "parkingspaces.pb.h"
+#include "callpool.h"
+#include "../database/database.h"
+#include <grpcpp/support/byte_buffer.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The state of every space in the lot, already serialized as the messages of the fetchAllParkingStates stream.
+ *
+ * It's built from the database by the first call that needs it, the calls that follow share the same buffers instead
+ * of loading and serializing the lot again (Writing one of them only takes a reference to its slices). The published
+ * changes are kept aside and patched into a new version of the snapshot by the next call that reads it, so a burst of
+ * changes costs one copy of the list instead of one for every change.
+ *
+ * Like the subscriber lists, a version is never modified once it's out: readers take the current one without a lock
+ * and keep it for as long as they are writing it.
+ */
+class LotSnapshot {
+
+public:
+    typedef std::vector<grpc::ByteBuffer> Messages;
+
+private:
+    std::shared_ptr<Database> db;
+
+    /**
+     * The version the readers get, nullptr when it has to be built or patched first
+     */
+    std::shared_ptr<const Messages> current;
+
+    /**
+     * The last version that was built and the position of every space in it
+     */
+    std::shared_ptr<const Messages> latest;
+
+    std::unordered_map<int, size_t> positions;
+
+    /**
+     * The changes that aren't in the latest version yet, by space. They come and go with every burst of changes, so
+     * their nodes are taken from the pool
+     */
+    std::unordered_map<int, parkingspaces::ParkingSpaceStatus, std::hash<int>, std::equal_to<int>,
+            PoolAllocator<std::pair<const int, parkingspaces::ParkingSpaceStatus>>> pending;
+
+    /**
+     * Guards everything but the current version, which is read without it
+     */
+    std::mutex writeLock;
+
+public:
+    explicit LotSnapshot(std::shared_ptr<Database> db);
+
+    /**
+     * The snapshot if it's up to date, without touching the database
+     * @return nullptr when it has to be built or patched first
+     */
+    std::shared_ptr<const Messages> cached() const;
+
+    /**
+     * The snapshot, built from the database (Or patched with the latest changes) if it isn't up to date
+     */
+    std::shared_ptr<const Messages> get();
+
+    /**
+     * Keep a change that has already been written to the database, for the next version.
+     * Spaces that aren't in the snapshot yet are added at the end
+     */
+    void update(const parkingspaces::ParkingSpaceStatus &status);
+
+    /**
+     * Drop the snapshot, the next call builds it again from the database
+     */
+    void invalidate();
+
+private:
+    void build();
+
+    void patch();
+
+    static grpc::ByteBuffer serializeSpace(int spaceID, const std::string &section, parkingspaces::SpaceStates state);
+};
+
+#endif //RASPBERRY_LOTSNAPSHOT_H
@@ -1,7 +1,13 @@
 
 #include "parkingnotifications.h"
 #include "server.h"
+#include "eventarena.h"
+#include <chrono>
+#include <deque>
+#include <list>
+#include <mutex>
 #include <queue>
+#include <thread>
 
 /**
  * A brief explanation on how the grpc asynchronous system works and how it was taken advantage of here
@@ -23,30 +29,104 @@ enum CallStatus {
     C_CREATE, C_LISTENING, C_FINISH, C_FINISHED
 };
 
+/**
+ * The number of messages without a coalescing key a stream can have waiting for a slow client before it's disconnected.
+ * The ones with a key are already bounded by the number of keys (One per space)
+ */
+#define MAX_QUEUED_MESSAGES 1024
+
+/**
+ * How long a write can take before the client is considered stuck and disconnected, once messages queue up behind it
+ */
+#define SLOW_SUBSCRIBER_TIMEOUT_S 30
+
+static std::atomic<uint64_t> slowSubscribersDisconnected{0};
+
+static Gauge &activeStreams = Metrics::instance().gauge("parking_active_streams",
+                                                        "The server streams that have a client");
+
+static Gauge &queuedMessages = Metrics::instance().gauge("parking_queued_messages",
+                                                         "The messages queued for the clients that are behind, over "
+                                                         "every stream");
+
+static Histogram &writeLatency = Metrics::instance().histogram("parking_stream_write_seconds",
+                                                               "The time from starting a write on a stream to its "
+                                                               "completion");
+
 enum BiCallStatus {
     B_CREATE, B_WAITING, B_READ, B_WRITE, B_FINISHED
 };
 
+/**
+ * Told when gRPC is done with a call (It finished or the client went away)
+ */
+class DoneListener {
+public:
+    virtual void onDone() = 0;
+
+    virtual ~DoneListener() = default;
+};
+
 struct IsCancelledCallback final : public RPCContextBase {
-    IsCancelledCallback(const grpc::ServerContext &ctx)
-            : _ctx(ctx) {}
+    IsCancelledCallback(const grpc::ServerContext &ctx, DoneListener *listener)
+            : _ctx(ctx), listener(listener) {}
 
-    void Proceed() override {
+    void Proceed(bool ok) override {
         isCancelled = _ctx.IsCancelled();
+
+        //This can free the call (And this callback with it), so it must be the last thing done here
+        listener->onDone();
     }
 
-    bool isCancelled = false;
+    /**
+     * Read by the publishers while the completion queue thread sets it
+     */
+    std::atomic_bool isCancelled{false};
 
 private:
     const grpc::ServerContext &_ctx;
+
+    DoneListener *listener;
 };
 
-template<class Res>
-class CallData : public Writable<Res> {
+/**
+ * Server -> client stream call data
+ * @tparam Res The type of the messages the server streams
+ * @tparam Service The service the stream belongs to
+ */
+template<class Res, class Service = NotificationsService>
+class CallData : public Writable<Res>, public DoneListener {
 protected:
     std::atomic_bool readyToReceive;
 
-    std::queue<Res> messageQueue;
+    typedef std::pair<int, std::shared_ptr<const Res>> QueuedMessage;
+
+    typedef std::list<QueuedMessage, PoolAllocator<QueuedMessage>> MessageQueue;
+
+    /**
+     * The messages waiting for the write in flight, each with its coalescing key. There is at most one message per
+     * key, a newer one replaces it (At the back of the queue, so the messages stay in the order they were published).
+     * The messages are shared with the queues of the other subscribers they were published to
+     */
+    MessageQueue messageQueue;
+
+    std::unordered_map<int, typename MessageQueue::iterator, std::hash<int>, std::equal_to<int>,
+            PoolAllocator<std::pair<const int, typename MessageQueue::iterator>>> queuedKeys;
+
+    /**
+     * The queued messages without a coalescing key, which are bounded by MAX_QUEUED_MESSAGES
+     */
+    size_t uncoalesced;
+
+    /**
+     * When the write in flight was started, to tell when the client is stuck
+     */
+    std::chrono::steady_clock::time_point writeStarted;
+
+    /**
+     * Whether the client was disconnected for not keeping up, nothing else is queued for it then
+     */
+    bool slow;
 
     grpc::ServerAsyncWriter<Res> responder_;
 
@@ -58,7 +138,7 @@ protected:
 
     // The means of communication with the gRPC runtime for an asynchronous
     // server.
-    parkingspaces::ParkingNotifications::AsyncService *service_;
+    Service *service_;
 
     // The producer-consumer queue where for asynchronous server notifications.
     grpc::ServerCompletionQueue *cq_;
@@ -67,54 +147,98 @@ protected:
     // client.
     grpc::ServerContext ctx_;
 
-    CallStatus status_;  // The current serving state.
+    std::atomic<CallStatus> status_;  // The current serving state.
+
+    /**
+     * Whether the Finish of the call has completed and whether the done notification has been delivered.
+     * The call can only be freed once both have (See releaseIfDone)
+     */
+    bool finished, done;
+
+    /**
+     * Publishers write from their own threads without any lock on the subscriber list, so the queue and the
+     * responder are guarded by the call itself
+     */
+    std::mutex callLock;
+
+    /**
+     * The reference the call holds to itself while it is alive. The subscriber lists hold the others, so the call is
+     * only freed once it's finished and no publisher is still using an older list that contains it
+     */
+    std::shared_ptr<Writable<Res>> self;
 public:
-    CallData(parkingspaces::ParkingNotifications::AsyncService *service, grpc::ServerCompletionQueue *cq,
+    CallData(Service *service, grpc::ServerCompletionQueue *cq,
              Subscribers<Res> *subs)
             : service_(service),
               cq_(cq),
               status_(C_CREATE),
-              _isCancelled(ctx_),
+              _isCancelled(ctx_, this),
               responder_(&ctx_),
               count(0),
               subs(subs),
               readyToReceive(false),
-              messageQueue() {
+              messageQueue(),
+              uncoalesced(0),
+              writeStarted(std::chrono::steady_clock::now()),
+              slow(false),
+              finished(false),
+              done(false),
+              self(this, std::default_delete<Writable<Res>>(), PoolAllocator<Writable<Res>>()) {
         ctx_.AsyncNotifyWhenDone(&_isCancelled);
     }
 
+    ~CallData() override {
+        queuedMessages.add(-(int64_t) messageQueue.size());
+
+        if (count > 0) activeStreams.add(-1);
+    }
+
 public:
 
     bool isCancelled() const override { return _isCancelled.isCancelled; }
 
     void write(const Res &toWrite) override {
-        bool tVal = true;
-
-        if (readyToReceive.compare_exchange_strong(tVal, false)) {
-            responder_.Write(toWrite, this);
-        } else {
-            messageQueue.push(toWrite);
-        }
+        std::unique_lock<std::mutex> acqLock(this->callLock);
 
+        queueWrite(toWrite);
     };
 
+    void writeShared(SharedMessage<Res> &message) override {
+        std::unique_lock<std::mutex> acqLock(this->callLock);
+
+        queueWrite(message);
+    }
+
     void end() override {
+        std::unique_lock<std::mutex> acqLock(this->callLock);
+
+        if (status_ == C_FINISH || status_ == C_FINISHED) return;
 
         bool tVal = true;
 
         if (this->readyToReceive.compare_exchange_strong(tVal, false)) {
-            if (status_ != C_FINISHED) {
-                status_ = C_FINISHED;
+            finishCall();
+        } else {
+            //Finish once the queued messages have been written
+            status_ = C_FINISH;
+        }
+    }
 
-//            subs->unregisterSubscriber(this);
+    void onDone() override {
+        std::unique_lock<std::mutex> acqLock(this->callLock);
 
-                responder_.Finish(grpc::Status::OK, this);
-            } else {
-                return;
-            }
+        this->done = true;
+
+        bool tVal = true;
+
+        //The client went away while nothing was being written, nothing else would ever finish the call
+        if (status_ == C_LISTENING && readyToReceive.compare_exchange_strong(tVal, false)) {
+            finishCall();
         }
 
-        status_ = C_FINISH;
+        auto last = releaseIfDone();
+
+        acqLock.unlock();
     }
 
     virtual void registerRequest() = 0;
@@ -125,27 +249,147 @@ public:
 
     virtual bool shouldReceive(const Res &res) = 0;
 
+    /**
+     * The key of a message that has to be queued, a queued message with the same key is replaced by it.
+     * Only asked while the client is behind
+     */
+    virtual int coalescingKey(const Res &res) {
+        return NO_COALESCING_KEY;
+    }
+
+protected:
+    /**
+     * Write a message or queue it behind the ones being written, the call lock must be held
+     */
+    void queueWrite(const Res &toWrite) {
+        SharedMessage<Res> message(toWrite);
+
+        queueWrite(message);
+    }
+
+    void queueWrite(SharedMessage<Res> &message) {
+        //A publisher can still hold this call from an older subscriber list after it has finished
+        if (status_ == C_FINISHED || slow) return;
+
+        const Res &toWrite = message.get();
+
+        bool tVal = true;
+
+        if (readyToReceive.compare_exchange_strong(tVal, false)) {
+            startWrite(toWrite);
+
+            return;
+        }
+
+        if (std::chrono::steady_clock::now() - writeStarted > std::chrono::seconds(SLOW_SUBSCRIBER_TIMEOUT_S)) {
+            disconnectSlow();
+
+            return;
+        }
+
+        int key = message.hasCoalescingKey() ? message.getCoalescingKey() : coalescingKey(toWrite);
+
+        if (key != NO_COALESCING_KEY) {
+            auto queued = queuedKeys.find(key);
+
+            if (queued != queuedKeys.end()) {
+                messageQueue.erase(queued->second);
+
+                queuedKeys.erase(queued);
+
+                queuedMessages.add(-1);
+            }
+        } else if (++uncoalesced > MAX_QUEUED_MESSAGES) {
+            disconnectSlow();
+
+            return;
+        }
+
+        messageQueue.emplace_back(key, message.share());
+
+        queuedMessages.add(1);
+
+        if (key != NO_COALESCING_KEY) {
+            queuedKeys[key] = std::prev(messageQueue.end());
+        }
+    }
+
 private:
+    void startWrite(const Res &res) {
+        writeStarted = std::chrono::steady_clock::now();
+
+        responder_.Write(res, this);
+    }
+
     void clearQueue() {
         if (messageQueue.empty()) {
             readyToReceive.store(true);
         } else {
-            Res &res = messageQueue.front();
+            auto &queued = messageQueue.front();
 
-            responder_.Write(res, this);
+            startWrite(*queued.second);
 
-            messageQueue.pop();
+            if (queued.first != NO_COALESCING_KEY) {
+                queuedKeys.erase(queued.first);
+            } else {
+                uncoalesced--;
+            }
+
+            messageQueue.pop_front();
+
+            queuedMessages.add(-1);
         }
     }
 
+    /**
+     * Drop what was queued for a client that isn't keeping up and cancel the call. The write in flight fails, which
+     * finishes the call as for any client that went away
+     */
+    void disconnectSlow() {
+        slow = true;
+
+        LOG_WARN("Disconnecting slow subscriber", {"call", (const void *) this}, {"queued", messageQueue.size()});
+
+        queuedMessages.add(-(int64_t) messageQueue.size());
+
+        messageQueue.clear();
+        queuedKeys.clear();
+        uncoalesced = 0;
+
+        slowSubscribersDisconnected++;
+
+        ctx_.TryCancel();
+    }
+
+    void finishCall() {
+        status_ = C_FINISHED;
+
+        responder_.Finish(grpc::Status::OK, this);
+    }
+
+    /**
+     * Let go of our own reference once gRPC is done with the call, the call is freed then unless a publisher is still
+     * holding it. A call that was never started never gets the done notification, so it only waits for the finish
+     * @return The reference, to be dropped after the call lock is released
+     */
+    std::shared_ptr<Writable<Res>> releaseIfDone() {
+        if (!finished || (count > 0 && !done)) return nullptr;
+
+        subs->unregisterSubscriber(this);
+
+        return std::move(self);
+    }
+
 public:
 
-    void Proceed() override {
+    void Proceed(bool ok) override {
+
+        std::unique_lock<std::mutex> acqLock(this->callLock);
 
         switch (status_) {
             case C_CREATE: {
 
-                std::cout << "Waiting for parking state" << std::endl;
+                LOG_DEBUG("Waiting for parking state", {"call", (const void *) this});
 
                 this->status_ = C_LISTENING;
 
@@ -155,7 +399,28 @@ public:
             }
             case C_LISTENING: {
 
-                std::cout << "Listening... Queued messages: " << messageQueue.size() << std::endl;
+                if (!ok) {
+                    if (count == 0) {
+                        //The server is shutting down before a client took this call
+                        this->status_ = C_FINISHED;
+                        this->finished = true;
+
+                        auto last = releaseIfDone();
+
+                        acqLock.unlock();
+                    } else {
+                        //The write failed, the client is gone
+                        finishCall();
+                    }
+
+                    break;
+                }
+
+                LOG_DEBUG("Listening", {"call", (const void *) this}, {"queued", messageQueue.size()});
+
+                if (count > 0) {
+                    writeLatency.recordSince(writeStarted);
+                }
 
                 clearQueue();
 
@@ -163,10 +428,12 @@ public:
 
                     initializeNewRq();
 
-                    subs->registerSubscriber(this);
+                    subs->registerSubscriber(self);
 
                     count++;
 
+                    activeStreams.add(1);
+
                     onReady();
                 }
 
@@ -174,22 +441,29 @@ public:
             }
             case C_FINISH: {
 
-                if (!this->messageQueue.empty()) {
+                if (ok && count > 0) {
+                    writeLatency.recordSince(writeStarted);
+                }
+
+                if (ok && !this->messageQueue.empty()) {
                     clearQueue();
 
                     return;
                 }
 
-                status_ = C_FINISHED;
-//                subs->unregisterSubscriber(this);
-                std::cout << "Called finish 2" << std::endl;
-                responder_.Finish(grpc::Status::OK, this);
+                LOG_DEBUG("Finishing call", {"call", (const void *) this});
+                finishCall();
                 break;
             }
             case C_FINISHED: {
 
-                std::cout << "Deleting " << this << " C" << std::endl;
-                delete this;
+                LOG_DEBUG("Finished call", {"call", (const void *) this});
+
+                this->finished = true;
+
+                auto last = releaseIfDone();
+
+                acqLock.unlock();
 
                 break;
             }
@@ -204,13 +478,29 @@ public:
  * @tparam Res The type of the request that the server responds
  */
 template<class Req, class Res>
-class BiDirectionalCallData : public Writable<Res>, public Readable<Req> {
+class BiDirectionalCallData : public Writable<Res>, public Readable<Req>, public DoneListener {
 protected:
     std::atomic_bool writeReady, finish;
 
     std::atomic_int readQueue;
 
-    std::queue<Res> messageQueue;
+    /**
+     * The messages waiting for the read or write in flight, shared with the other subscribers they were published to.
+     * Bounded by MAX_QUEUED_MESSAGES
+     */
+    std::queue<std::shared_ptr<const Res>, std::deque<std::shared_ptr<const Res>,
+            PoolAllocator<std::shared_ptr<const Res>>>> messageQueue;
+
+    /**
+     * When the read or write in flight was started. A plate reader that doesn't answer a read is as stuck as one that
+     * doesn't take a write, the messages pile up behind either
+     */
+    std::chrono::steady_clock::time_point operationStarted;
+
+    /**
+     * See CallData::slow
+     */
+    bool slow;
 
     Subscribers<Res> *subs;
 
@@ -220,7 +510,7 @@ protected:
 
     // The means of communication with the gRPC runtime for an asynchronous
     // server.
-    parkingspaces::ParkingNotifications::AsyncService *service_;
+    NotificationsService *service_;
 
     // The producer-consumer queue where for asynchronous server notifications.
     grpc::ServerCompletionQueue *cq_;
@@ -235,25 +525,50 @@ protected:
 
     Req request;
 
+    /**
+     * See CallData::finished
+     */
+    bool finished, done;
+
+    /**
+     * Guards the queue and the responder between the publishers and the completion queue thread.
+     * Recursive because handling a message can lead the server to write back to this same call
+     */
+    std::recursive_mutex callLock;
+
+    /**
+     * See CallData::self
+     */
+    std::shared_ptr<Writable<Res>> self;
+
 public:
-    BiDirectionalCallData(parkingspaces::ParkingNotifications::AsyncService *service, grpc::ServerCompletionQueue *cq,
+    BiDirectionalCallData(NotificationsService *service, grpc::ServerCompletionQueue *cq,
                           Subscribers<Res> *subs) :
             service_(service),
             cq_(cq),
             status(B_CREATE),
-            _isCancelled(ctx_),
+            _isCancelled(ctx_, this),
             responder(&ctx_),
             count(0),
             subs(subs),
             readQueue(0),
             writeReady(true),
             finish(false),
-            messageQueue() {
+            messageQueue(),
+            operationStarted(std::chrono::steady_clock::now()),
+            slow(false),
+            finished(false),
+            done(false),
+            self(this, std::default_delete<Writable<Res>>(), PoolAllocator<Writable<Res>>()) {
 
         ctx_.AsyncNotifyWhenDone(&_isCancelled);
 
     }
 
+    ~BiDirectionalCallData() override {
+        queuedMessages.add(-(int64_t) messageQueue.size());
+    }
+
 public:
     virtual void registerRequest() = 0;
 
@@ -275,11 +590,13 @@ public:
      * This message will be delivered on the handleNewMessage(const Req&) function
      */
     void readMessage() override {
+        std::unique_lock<std::recursive_mutex> acqLock(this->callLock);
+
         BiCallStatus orig = B_WAITING;
 
         if (this->status.compare_exchange_strong(orig, B_READ)) {
             if ((readQueue++) == 0) {
-                responder.Read(&request, this);
+                startRead();
             }
         } else {
             readQueue++;
@@ -287,6 +604,16 @@ public:
     }
 
     void write(const Res &toWrite) override {
+        SharedMessage<Res> message(toWrite);
+
+        writeShared(message);
+    };
+
+    void writeShared(SharedMessage<Res> &message) override {
+
+        std::unique_lock<std::recursive_mutex> acqLock(this->callLock);
+
+        if (status.load() == B_FINISHED || slow) return;
 
         bool tVal = true;
 
@@ -294,28 +621,55 @@ public:
 
         if (this->status.compare_exchange_strong(callStatus, B_WRITE)) {
             if (writeReady.compare_exchange_strong(tVal, false)) {
-                std::cout << "Writing..." << std::endl;
-                responder.Write(toWrite, this);
-            } else {
-                std::cout << "Writing 2..." << std::endl;
-                messageQueue.push(toWrite);
+                LOG_DEBUG("Writing", {"call", (const void *) this});
+                startWrite(message.get());
+
+                return;
             }
+
+            LOG_DEBUG("Queueing write, a write is in flight", {"call", (const void *) this});
         } else {
-            std::cout << "Writing 3..." << std::endl;
-            messageQueue.push(toWrite);
+            LOG_DEBUG("Queueing write, a read is in flight", {"call", (const void *) this});
         }
+
+        if (std::chrono::steady_clock::now() - operationStarted > std::chrono::seconds(SLOW_SUBSCRIBER_TIMEOUT_S) ||
+            messageQueue.size() >= MAX_QUEUED_MESSAGES) {
+            disconnectSlow();
+
+            return;
+        }
+
+        messageQueue.push(message.share());
+
+        queuedMessages.add(1);
     };
 
     void end() override {
-        if (readQueue == 0 && this->messageQueue.empty() && status.load() != B_FINISHED) {
-            status.store(B_FINISHED);
-//            subs->unregisterSubscriber(this);
-            responder.Finish(grpc::Status::OK, this);
+        std::unique_lock<std::recursive_mutex> acqLock(this->callLock);
+
+        //Only finish right away when no read or write is in flight, gRPC allows one of each at a time
+        if (status.load() == B_WAITING && readQueue == 0 && this->messageQueue.empty()) {
+            finishCall();
         } else {
             finish.store(true);
         }
     }
 
+    void onDone() override {
+        std::unique_lock<std::recursive_mutex> acqLock(this->callLock);
+
+        this->done = true;
+
+        //The client went away while nothing was in flight, nothing else would ever finish the call
+        if (count > 0 && status.load() == B_WAITING) {
+            finishCall();
+        }
+
+        auto last = releaseIfDone();
+
+        acqLock.unlock();
+    }
+
 private:
     /**
      * Returns whether the queue was already empty when called
@@ -327,25 +681,105 @@ private:
 
             return true;
         } else {
-            Res &res = messageQueue.front();
-
-            responder.Write(res, this);
+            startWrite(*messageQueue.front());
 
             messageQueue.pop();
 
+            queuedMessages.add(-1);
+
             return messageQueue.empty();
         }
     }
 
+    void startWrite(const Res &res) {
+        operationStarted = std::chrono::steady_clock::now();
+
+        responder.Write(res, this);
+    }
+
+    void startRead() {
+        operationStarted = std::chrono::steady_clock::now();
+
+        responder.Read(&request, this);
+    }
+
+    /**
+     * See CallData::disconnectSlow, the read or write in flight fails and finishes the call
+     */
+    void disconnectSlow() {
+        slow = true;
+
+        LOG_WARN("Disconnecting slow subscriber", {"call", (const void *) this}, {"queued", messageQueue.size()});
+
+        queuedMessages.add(-(int64_t) messageQueue.size());
+
+        messageQueue = decltype(messageQueue)();
+
+        slowSubscribersDisconnected++;
+
+        ctx_.TryCancel();
+    }
+
+    void finishCall() {
+        this->status.store(B_FINISHED);
+
+        responder.Finish(grpc::Status::OK, this);
+    }
+
+    /**
+     * See CallData::releaseIfDone
+     */
+    std::shared_ptr<Writable<Res>> releaseIfDone() {
+        if (!finished || (count > 0 && !done)) return nullptr;
+
+        subs->unregisterSubscriber(this);
+
+        return std::move(self);
+    }
+
+    void startCall() {
+        if (count == 0) {
+            initializeNewRq();
+
+            count++;
+
+            onReady();
+
+            subs->registerSubscriber(self);
+        }
+    }
+
 public:
 
-    void Proceed() override {
+    void Proceed(bool ok) override {
+
+        std::unique_lock<std::recursive_mutex> acqLock(this->callLock);
+
+        if (!ok && status.load() != B_CREATE && status.load() != B_FINISHED) {
+
+            if (count == 0) {
+                //The server is shutting down before a client took this call
+                this->status.store(B_FINISHED);
+                this->finished = true;
+
+                auto last = releaseIfDone();
+
+                acqLock.unlock();
+            } else {
+                //The read or write failed, the client is gone (Or has stopped sending)
+                LOG_DEBUG("Bi directional stream closed", {"call", (const void *) this});
+
+                finishCall();
+            }
+
+            return;
+        }
 
         switch (status.load()) {
 
             case B_CREATE:
 
-                std::cout << "Waiting for bi direction stream " << std::endl;
+                LOG_DEBUG("Waiting for bi directional stream", {"call", (const void *) this});
 
                 this->status.store(B_WAITING);
 
@@ -354,36 +788,20 @@ public:
                 break;
             case B_WAITING:
 
-                std::cout << "waiting... " << count << std::endl;
-
-                if (count == 0) {
-                    initializeNewRq();
-
-                    count++;
-
-                    onReady();
+                LOG_DEBUG("Bi directional stream waiting", {"call", (const void *) this}, {"count", count});
 
-                    subs->registerSubscriber(this);
-                }
+                startCall();
 
                 break;
             case B_READ:
 
-                std::cout << "Bi directional read tick." << std::endl;
+                LOG_DEBUG("Bi directional read tick", {"call", (const void *) this});
 
-                if (count == 0) {
-                    initializeNewRq();
-
-                    count++;
-
-                    onReady();
-
-                    subs->registerSubscriber(this);
-                }
+                startCall();
 
                 handleNewMessage(request);
 
-                std::cout << readQueue << std::endl;
+                LOG_DEBUG("Bi directional read handled", {"call", (const void *) this}, {"reads", readQueue.load()});
 
                 if (--readQueue == 0) {
 
@@ -391,35 +809,25 @@ public:
                         //If we have something to write, start writing it
                         this->status.store(B_WRITE);
 
-                        std::cout << "Moved to write " << std::endl;
+                        LOG_DEBUG("Moved to write", {"call", (const void *) this});
                         clearQueue();
                     } else if (this->finish.load()) {
-                        this->status.store(B_FINISHED);
-                        subs->unregisterSubscriber(this);
-                        responder.Finish(grpc::Status::OK, this);
+                        finishCall();
                     } else {
                         //If we have nothing to write, returning to the waiting state
                         this->status.store(B_WAITING);
-                        std::cout << "Moved to wait " << std::endl;
+                        LOG_DEBUG("Moved to wait", {"call", (const void *) this});
                     }
                 } else {
-                    responder.Read(&request, this);
+                    startRead();
                 }
 
                 break;
             case B_WRITE:
 
-                if (count == 0) {
-                    initializeNewRq();
+                startCall();
 
-                    count++;
-
-                    onReady();
-
-                    subs->registerSubscriber(this);
-                }
-
-                std::cout << "Bi direction write tick" << std::endl;
+                LOG_DEBUG("Bi directional write tick", {"call", (const void *) this});
 
                 if (clearQueue()) {
 
@@ -427,16 +835,14 @@ public:
 
                     if (readQueue > 0) {
                         //If we have something to read, start reading
-                        std::cout << "Moved to wait after read" << std::endl;
+                        LOG_DEBUG("Moved to read after write", {"call", (const void *) this});
                         this->status.store(B_READ);
-                        responder.Read(&request, this);
+                        startRead();
                     } else if (this->finish.load()) {
-                        this->status.store(B_FINISHED);
-//                        subs->unregisterSubscriber(this);
-                        responder.Finish(grpc::Status::OK, this);
+                        finishCall();
                     } else {
                         //If we have nothing to read, then go back into waiting
-                        std::cout << "Moved to wait after write" << std::endl;
+                        LOG_DEBUG("Moved to wait after write", {"call", (const void *) this});
                         this->status.store(B_WAITING);
                     }
                 } else {
@@ -444,10 +850,17 @@ public:
                 }
 
                 break;
-            case B_FINISHED:
-                std::cout << "Deleting " << this << " B" << std::endl;
-                delete this;
+            case B_FINISHED: {
+                LOG_DEBUG("Finished bi directional call", {"call", (const void *) this});
+
+                this->finished = true;
+
+                auto last = releaseIfDone();
+
+                acqLock.unlock();
+
                 break;
+            }
         }
 
     }
@@ -456,15 +869,18 @@ public:
 /**
  * The class that handles the notifications for parking space updates
  */
-class ParkingSpacesData : public CallData<parkingspaces::ParkingSpaceStatus> {
+class ParkingSpacesData : public CallData<grpc::ByteBuffer> {
 private:
-    parkingspaces::ParkingSpacesRq request;
+    /**
+     * The (serialized) ParkingSpacesRq, as this stream is raw
+     */
+    grpc::ByteBuffer request;
 
 public:
-    ParkingSpacesData(parkingspaces::ParkingNotifications::AsyncService *service, grpc::ServerCompletionQueue *cq,
-                      Subscribers<parkingspaces::ParkingSpaceStatus> *subscribers) : CallData(service,
-                                                                                              cq, subscribers) {
-        Proceed();
+    ParkingSpacesData(NotificationsService *service, grpc::ServerCompletionQueue *cq,
+                      Subscribers<grpc::ByteBuffer> *subscribers) : CallData(service,
+                                                                             cq, subscribers) {
+        Proceed(true);
     }
 
 public:
@@ -477,7 +893,7 @@ public:
         new ParkingSpacesData(service_, cq_, subs);
     }
 
-    bool shouldReceive(const parkingspaces::ParkingSpaceStatus &res) override {
+    bool shouldReceive(const grpc::ByteBuffer &res) override {
         return true;
     }
 
@@ -485,6 +901,37 @@ public:
 
 };
 
+/**
+ * The batched parking state stream, the batches are written already serialized like the updates of the plain stream
+ */
+class BatchedStatesData : public CallData<grpc::ByteBuffer, SyncService> {
+private:
+    /**
+     * The (serialized) ParkingSpacesRq, as this stream is raw
+     */
+    grpc::ByteBuffer request;
+
+public:
+    BatchedStatesData(SyncService *service, grpc::ServerCompletionQueue *cq,
+                      Subscribers<grpc::ByteBuffer> *subscribers) : CallData(service, cq, subscribers) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestsubscribeToParkingStatesBatched(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new BatchedStatesData(service_, cq_, subs);
+    }
+
+    bool shouldReceive(const grpc::ByteBuffer &res) override {
+        return true;
+    }
+
+    void onReady() override {}
+};
+
 /**
  * The class for handling the reservation status notification requests
  */
@@ -493,10 +940,10 @@ private:
     parkingspaces::ParkingSpaceReservation request;
 
 public:
-    ReservationSpaceData(parkingspaces::ParkingNotifications::AsyncService *service, grpc::ServerCompletionQueue *cq,
+    ReservationSpaceData(NotificationsService *service, grpc::ServerCompletionQueue *cq,
                          Subscribers<parkingspaces::ReserveStatus> *subs) :
             CallData(service, cq, subs) {
-        Proceed();
+        Proceed(true);
     }
 
 public:
@@ -514,7 +961,274 @@ public:
         return false;
     }
 
+    int subscriptionKey() const override {
+        return request.spaceid();
+    }
+
+    void onReady() override {
+    }
+};
+
+/**
+ * A version that no change can be above, so nothing is delivered to the stream before it's synced
+ */
+#define NOT_SYNCED UINT64_MAX
+
+/**
+ * The change stream. The client tells us the last version it has seen and first gets the changes it missed (Or a
+ * snapshot of the lot, when they are no longer kept), then every change after them
+ */
+class SpaceChangesData : public CallData<parkingext::SpaceChanges, parkingext::ParkingSync::AsyncService> {
+private:
+    parkingext::SyncRequest request;
+
+    ChangeLog *log;
+
+    ParkingServer *sv;
+
+    /**
+     * The version the first message brought the client up to, only the changes after it are delivered
+     */
+    std::atomic<uint64_t> syncedVersion;
+
+public:
+    SpaceChangesData(parkingext::ParkingSync::AsyncService *service, grpc::ServerCompletionQueue *cq,
+                     Subscribers<parkingext::SpaceChanges> *subs, ChangeLog *log, ParkingServer *sv) :
+            CallData(service, cq, subs),
+            log(log),
+            sv(sv),
+            syncedVersion(NOT_SYNCED) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestsubscribeToChanges(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new SpaceChangesData(service_, cq_, subs, log, sv);
+    }
+
+    bool shouldReceive(const parkingext::SpaceChanges &res) override {
+        return res.version() > syncedVersion.load();
+    }
+
+    int coalescingKey(const parkingext::SpaceChanges &res) override {
+        //The newer change is queued after the ones in between, so the versions the client gets still only grow
+        if (res.spaces_size() != 1 || res.spaces(0).firealarm()) return NO_COALESCING_KEY;
+
+        return res.spaces(0).spaceid();
+    }
+
+    void onReady() override {
+        //We're already registered, so whatever is published after the version we sync to reaches us
+        std::vector<parkingspaces::ParkingSpaceStatus> missed;
+
+        bool complete = log->changesSince(request.epoch(), request.version(), missed, syncedVersion);
+
+        parkingext::SpaceChanges changes;
+
+        changes.set_epoch(log->getEpoch());
+        changes.set_version(syncedVersion.load());
+        changes.set_snapshot(!complete);
+
+        if (complete) {
+            for (auto &status : missed) {
+                *changes.add_spaces() = std::move(status);
+            }
+        } else {
+            //Changes published while the snapshot is read are sent again after it, they are the latest states
+            auto spaceStates = sv->getDatabase()->fetchAllSpaceStates();
+
+            for (const auto &space : *spaceStates) {
+                auto status = changes.add_spaces();
+
+                status->set_spaceid(space.getSpaceId());
+                status->set_spacesection(space.getSection());
+                status->set_spacestate(space.getState());
+            }
+        }
+
+        LOG_INFO("Syncing changes", {"since", request.version()}, {"to", changes.version()}, {"snapshot", !complete});
+
+        queueWrite(changes);
+    }
+};
+
+/**
+ * The stream of a section: the current state of its spaces, then every change of them
+ */
+class SectionData : public CallData<parkingspaces::ParkingSpaceStatus, parkingext::ParkingAvailability::AsyncService> {
+private:
+    parkingext::SectionRq request;
+
+    ParkingServer *sv;
+
+public:
+    SectionData(parkingext::ParkingAvailability::AsyncService *service, grpc::ServerCompletionQueue *cq,
+                Subscribers<parkingspaces::ParkingSpaceStatus> *subs, ParkingServer *sv) :
+            CallData(service, cq, subs),
+            sv(sv) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestsubscribeToSection(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new SectionData(service_, cq_, subs, sv);
+    }
+
+    bool shouldReceive(const parkingspaces::ParkingSpaceStatus &res) override {
+        //The empty section is the whole lot
+        return request.section().empty() || res.spacesection() == request.section();
+    }
+
+    int subscriptionKey() const override {
+        return request.section().empty() ? NO_SUBSCRIPTION_KEY : sectionKey(request.section());
+    }
+
+    int coalescingKey(const parkingspaces::ParkingSpaceStatus &res) override {
+        return res.firealarm() ? NO_COALESCING_KEY : res.spaceid();
+    }
+
     void onReady() override {
+        //We're already registered, a change the states we read miss is written after them
+        for (const auto &status : sv->getSectionCounters()->spacesIn(request.section())) {
+            queueWrite(status);
+        }
+    }
+};
+
+enum AvailabilityCallStatus {
+    A_CREATE, A_PROCESS, A_FINISHED
+};
+
+/**
+ * A unary call of the availability service. The counts are already kept, so it's answered right away on the
+ * completion queue thread
+ * @tparam Res The type of the response
+ */
+template<class Res>
+class AvailabilityCallData : public RPCContextBase {
+protected:
+    parkingext::ParkingAvailability::AsyncService *service_;
+
+    grpc::ServerCompletionQueue *cq_;
+
+    grpc::ServerContext ctx_;
+
+    parkingext::SectionRq request;
+
+    Res response;
+
+    grpc::ServerAsyncResponseWriter<Res> responder_;
+
+    AvailabilityCallStatus status_;
+
+    ParkingServer *sv;
+
+public:
+    AvailabilityCallData(parkingext::ParkingAvailability::AsyncService *service, grpc::ServerCompletionQueue *cq,
+                         ParkingServer *sv) :
+            service_(service),
+            cq_(cq),
+            responder_(&ctx_),
+            status_(A_CREATE),
+            sv(sv) {}
+
+    virtual void registerRequest() = 0;
+
+    virtual void initializeNewRq() = 0;
+
+    virtual void handle() = 0;
+
+    void Proceed(bool ok) override {
+
+        switch (status_) {
+            case A_CREATE:
+
+                status_ = A_PROCESS;
+
+                registerRequest();
+
+                break;
+            case A_PROCESS:
+
+                if (!ok) {
+                    //The server is shutting down before a client took this call
+                    delete this;
+
+                    break;
+                }
+
+                initializeNewRq();
+
+                handle();
+
+                status_ = A_FINISHED;
+
+                responder_.Finish(response, grpc::Status::OK, this);
+
+                break;
+            case A_FINISHED:
+
+                delete this;
+
+                break;
+        }
+    }
+
+protected:
+    static void fillAvailability(parkingext::SectionAvailability *availability, const std::string &section,
+                                 const SectionCount &count) {
+        availability->set_section(section);
+        availability->set_free(count.free);
+        availability->set_occupied(count.occupied);
+        availability->set_reserved(count.reserved);
+    }
+};
+
+class SectionAvailabilityData : public AvailabilityCallData<parkingext::SectionAvailability> {
+public:
+    SectionAvailabilityData(parkingext::ParkingAvailability::AsyncService *service, grpc::ServerCompletionQueue *cq,
+                            ParkingServer *sv) : AvailabilityCallData(service, cq, sv) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestfetchSectionAvailability(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new SectionAvailabilityData(service_, cq_, sv);
+    }
+
+    void handle() override {
+        fillAvailability(&response, request.section(), sv->getSectionCounters()->countFor(request.section()));
+    }
+};
+
+class LotAvailabilityData : public AvailabilityCallData<parkingext::LotAvailability> {
+public:
+    LotAvailabilityData(parkingext::ParkingAvailability::AsyncService *service, grpc::ServerCompletionQueue *cq,
+                        ParkingServer *sv) : AvailabilityCallData(service, cq, sv) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestfetchLotAvailability(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new LotAvailabilityData(service_, cq_, sv);
+    }
+
+    void handle() override {
+        for (const auto &section : sv->getSectionCounters()->allCounts()) {
+            fillAvailability(response.add_sections(), section.first, section.second);
+        }
     }
 };
 
@@ -525,12 +1239,12 @@ private:
 
     ParkingServer *sv;
 public:
-    PlateReader(parkingspaces::ParkingNotifications::AsyncService *service, grpc::ServerCompletionQueue *cq,
+    PlateReader(NotificationsService *service, grpc::ServerCompletionQueue *cq,
                 Subscribers<parkingspaces::PlateReadRequest> *subs, ParkingServer *sv) :
             BiDirectionalCallData(service, cq, subs),
             spaceID(-1),
             sv(sv) {
-        Proceed();
+        Proceed(true);
     }
 
     void registerRequest() override {
@@ -542,9 +1256,12 @@ public:
         if (req.registration()) {
             this->spaceID = req.spaceid();
 
-            std::cout << "Received new message " << req.spaceid() << std::endl;
+            //Move the reader under the key of its space
+            subs->registerSubscriber(self);
+
+            LOG_DEBUG("Plate reader registered", {"space", req.spaceid()});
         } else {
-            std::cout << "Received license plate" << std::endl;
+            LOG_DEBUG("Received license plate", {"space", req.spaceid()});
             sv->receiveLicensePlate(req.spaceid(), req.plate());
         }
     }
@@ -555,72 +1272,156 @@ public:
 
     bool shouldReceive(const parkingspaces::PlateReadRequest &res) override {
 
-        std::cout << this->spaceID << " " << res.spaceid() << std::endl;
-
         if (this->spaceID < 0) return false;
 
         return spaceID == res.spaceid();
     }
 
+    int subscriptionKey() const override {
+        return spaceID < 0 ? NO_SUBSCRIPTION_KEY : spaceID;
+    }
+
     void onReady() override {
         readMessage();
     }
 
 };
 
-ParkingNotificationsImpl::ParkingNotificationsImpl(ParkingServer *sv) :
-        parkingSpaceSubscribers(std::make_unique<Subscribers<parkingspaces::ParkingSpaceStatus>>()),
-        reservationSubscribers(std::make_unique<Subscribers<parkingspaces::ReserveStatus>>()),
-        plateReaders(std::make_unique<Subscribers<parkingspaces::PlateReadRequest>>()),
-        server(sv) {}
+ParkingNotificationsImpl::ParkingNotificationsImpl(ParkingServer *sv, unsigned completionQueues) :
+        parkingSpaceSubscribers(std::make_unique<Subscribers<grpc::ByteBuffer>>("parking_states")),
+        reservationSubscribers(std::make_unique<Subscribers<parkingspaces::ReserveStatus>>("reservations")),
+        plateReaders(std::make_unique<Subscribers<parkingspaces::PlateReadRequest>>("plate_readers")),
+        changeSubscribers(std::make_unique<Subscribers<parkingext::SpaceChanges>>("changes")),
+        sectionSubscribers(std::make_unique<Subscribers<parkingspaces::ParkingSpaceStatus>>("sections")),
+        batchSubscribers(std::make_unique<Subscribers<grpc::ByteBuffer>>("batched_states")),
+        statusBatcher(std::make_unique<StatusBatcher>([this](const parkingext::SpaceStatusBatch &batch) {
+            if (this->batchSubscribers->size() == 0) return;
+
+            this->batchSubscribers->publish(serializeMessage(batch));
+        })),
+        changeLog(std::make_unique<ChangeLog>()),
+        server(sv),
+        completionQueues(completionQueues) {
+
+    if (this->completionQueues == 0) {
+        this->completionQueues = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto &metrics = Metrics::instance();
+
+    metrics.observe("parking_slow_subscribers_disconnected_total",
+                    "The streams that were disconnected for not keeping up with their messages", MetricType::COUNTER,
+                    []() { return (double) getSlowSubscribersDisconnected(); }, this);
+
+    metrics.observe("parking_call_pool_heap_allocations_total", "The blocks of the calls taken from the heap",
+                    MetricType::COUNTER, []() { return (double) CallPool::getStats().heapAllocations; }, this);
+
+    metrics.observe("parking_call_pool_reused_total", "The blocks of the calls handed out again from the pool",
+                    MetricType::COUNTER, []() { return (double) CallPool::getStats().reused; }, this);
+
+    metrics.observe("parking_call_pool_free_blocks", "The blocks kept in the pool for the next calls",
+                    MetricType::GAUGE, []() { return (double) CallPool::getStats().pooled; }, this);
+}
+
+ParkingNotificationsImpl::~ParkingNotificationsImpl() {
+    Metrics::instance().removeObserved(this);
+}
 
 void ParkingNotificationsImpl::registerService(grpc::ServerBuilder &builder) {
 
     // Register "service_" as the instance through which we'll communicate with
     // clients. In this case it corresponds to an *asynchronous* service.
     builder.RegisterService(&service_);
-    // Get hold of the completion queue used for the asynchronous communication
+    builder.RegisterService(&syncService_);
+    builder.RegisterService(&availabilityService_);
+    // Get hold of the completion queues used for the asynchronous communication
     // with the gRPC runtime.
-    cq_ = builder.AddCompletionQueue();
+    for (unsigned i = 0; i < completionQueues; i++) {
+        cqs_.push_back(builder.AddCompletionQueue());
+    }
+}
+
+size_t ParkingNotificationsImpl::queueCount() const {
+    return cqs_.size();
 }
 
-void ParkingNotificationsImpl::run() {
-    std::cout << "Hell" << std::endl;
-    HandleRpcs();
+void ParkingNotificationsImpl::run(size_t queue) {
+    LOG_INFO("Serving notifications", {"queue", queue});
+    HandleRpcs(cqs_[queue].get());
 }
 
-void ParkingNotificationsImpl::HandleRpcs() {
+void ParkingNotificationsImpl::HandleRpcs(grpc::ServerCompletionQueue *cq) {
 
     // Spawn a new CallData instance to serve new clients
-    new ParkingSpacesData(&service_, cq_.get(), parkingSpaceSubscribers.get());
-    new ReservationSpaceData(&service_, cq_.get(), reservationSubscribers.get());
-    new PlateReader(&service_, cq_.get(), plateReaders.get(), server);
+    new ParkingSpacesData(&service_, cq, parkingSpaceSubscribers.get());
+    new ReservationSpaceData(&service_, cq, reservationSubscribers.get());
+    new PlateReader(&service_, cq, plateReaders.get(), server);
+    new SpaceChangesData(&syncService_, cq, changeSubscribers.get(), changeLog.get(), server);
+    new SectionData(&availabilityService_, cq, sectionSubscribers.get(), server);
+    new BatchedStatesData(&syncService_, cq, batchSubscribers.get());
+    new SectionAvailabilityData(&availabilityService_, cq, server);
+    new LotAvailabilityData(&availabilityService_, cq, server);
     void *tag;  // uniquely identifies a request.
     bool ok;
 
-    while (true) {
-        // Block waiting to read the next event from the completion queue. The
-        // event is uniquely identified by its tag, which in this case is the
-        // memory address of a CallData instance.
-        cq_->Next(&tag, &ok);
-        GPR_ASSERT(ok);
-        static_cast<RPCContextBase *>(tag)->Proceed();
+    // Block waiting to read the next event from the completion queue. The
+    // event is uniquely identified by its tag, which in this case is the
+    // memory address of a CallData instance.
+    // Failed events (ok == false) are handed to the call as well, Next only returns false once the queue
+    // has been shut down and drained
+    while (cq->Next(&tag, &ok)) {
+        static_cast<RPCContextBase *>(tag)->Proceed(ok);
     }
 }
 
 void ParkingNotificationsImpl::publishParkingSpaceUpdate(parkingspaces::ParkingSpaceStatus &status) {
-    this->parkingSpaceSubscribers->sendMessageToSubscribers(status);
+    //Serialize the update once instead of once for every subscriber, the streams that are behind can't read the
+    //space back from the buffer, so its coalescing key goes with it (An alarm isn't replaced by the state that follows)
+    this->parkingSpaceSubscribers->publish(serializeMessage(status),
+                                           status.firealarm() ? NO_COALESCING_KEY : status.spaceid());
+
+    //Every change stream (And the snapshot) gets the changes in the order of their versions. The log itself is
+    //unlocked while publishing: a stream that syncs takes it under the lock of its call, which publishing takes too
+    std::unique_lock<std::mutex> acqLock(this->publishLock);
+
+    uint64_t version = this->changeLog->record(status);
+
+    if (!status.firealarm()) {
+        this->server->getSpaces()->getLotSnapshot()->update(status);
+
+        this->server->getSectionCounters()->update(status.spaceid(), status.spacesection(),
+                                                   status.spacestate());
+    }
+
+    this->sectionSubscribers->publish(status);
+
+    this->statusBatcher->add(status);
+
+    EventArena arena;
+
+    auto changes = arena.create<parkingext::SpaceChanges>();
+
+    changes->set_epoch(this->changeLog->getEpoch());
+    changes->set_version(version);
+
+    *changes->add_spaces() = status;
+
+    this->changeSubscribers->publish(*changes);
+}
+
+uint64_t ParkingNotificationsImpl::getSlowSubscribersDisconnected() {
+    return slowSubscribersDisconnected.load();
 }
 
 void ParkingNotificationsImpl::publishReservationUpdate(parkingspaces::ReserveStatus &status) {
-    this->reservationSubscribers->sendMessageToSubscribers(status);
+    this->reservationSubscribers->publish(status);
 }
 
 void ParkingNotificationsImpl::endReservationStreamsFor(parkingspaces::ReserveStatus &status) {
     this->reservationSubscribers->endStreamsFor(status);
 }
 
-std::unique_ptr<std::vector<Writable<parkingspaces::PlateReadRequest> *>> ParkingNotificationsImpl::
+std::unique_ptr<Subscribers<parkingspaces::PlateReadRequest>::Delivery> ParkingNotificationsImpl::
 sendPlateReadRequest(parkingspaces::PlateReadRequest &req) {
     return this->plateReaders->sendMessageToSubscribers(req);
 }
@@ -2,15 +2,172 @@
 #define RASPBERRY_PARKINGNOTIFICATIONS_H
 
 #include "parkingspaces.grpc.pb.h"
+#include "parkingext.grpc.pb.h"
+#include "changelog.h"
+#include "statusbatcher.h"
+#include "callpool.h"
+#include "../log/logger.h"
+#include "../metrics/metrics.h"
 #include <grpc/support/log.h>
 #include <grpcpp/grpcpp.h>
+#include <grpcpp/support/byte_buffer.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
+/**
+ * The notification service, with the parking state stream registered as raw so that the updates can be
+ * written as already serialized ByteBuffers
+ */
+typedef parkingspaces::ParkingNotifications::WithRawMethod_subscribeToParkingStates<
+        parkingspaces::ParkingNotifications::AsyncService> NotificationsService;
+
+/**
+ * The sync service, with the batched stream registered as raw as well, every batch is serialized once
+ */
+typedef parkingext::ParkingSync::WithRawMethod_subscribeToParkingStatesBatched<
+        parkingext::ParkingSync::AsyncService> SyncService;
+
+/**
+ * Serialize a message once, so the same buffer can be written to many streams without serializing it again.
+ * Copying the resulting buffer only takes a reference to its slices
+ */
+template<typename T>
+grpc::ByteBuffer serializeMessage(const T &message) {
+
+    grpc::ByteBuffer buffer;
+
+    bool ownBuffer;
+
+    grpc::SerializationTraits<T>::Serialize(message, &buffer, &ownBuffer);
+
+    return buffer;
+}
+
 class RPCContextBase {
 public:
-    virtual void Proceed() = 0;
+    /**
+     * Handle an event of the call from the completion queue
+     * @param ok Whether the operation succeeded, it fails when the client went away or the server is shutting down
+     */
+    virtual void Proceed(bool ok) = 0;
 
     virtual ~RPCContextBase() = default;
+
+    /*
+     * Every call is made for a client and freed once it's done with it, so the calls come from the call pool
+     */
+
+    static void *operator new(size_t size) {
+        return CallPool::allocate(size);
+    }
+
+    static void operator delete(void *block, size_t size) {
+        CallPool::release(block, size);
+    }
+};
+
+/**
+ * The key of subscribers that receive every message (Or decide for themselves with shouldReceive)
+ */
+#define NO_SUBSCRIPTION_KEY (-1)
+
+/**
+ * The key a message is delivered by, subscribers registered with a key only see the messages with that key
+ */
+template<typename T>
+struct SubscriptionKey {
+    static int of(const T &) {
+        return NO_SUBSCRIPTION_KEY;
+    }
+};
+
+template<>
+struct SubscriptionKey<parkingspaces::ReserveStatus> {
+    static int of(const parkingspaces::ReserveStatus &status) {
+        return status.spaceid();
+    }
+};
+
+template<>
+struct SubscriptionKey<parkingspaces::PlateReadRequest> {
+    static int of(const parkingspaces::PlateReadRequest &request) {
+        return request.spaceid();
+    }
+};
+
+/**
+ * The key of the streams of a section, the names are hashed so the sections don't need to be known in advance.
+ * Two sections with the same key share the list, the streams tell their messages apart with shouldReceive
+ */
+inline int sectionKey(const std::string &section) {
+    return static_cast<int>(std::hash<std::string>()(section) & INT_MAX);
+}
+
+template<>
+struct SubscriptionKey<parkingspaces::ParkingSpaceStatus> {
+    static int of(const parkingspaces::ParkingSpaceStatus &status) {
+        return sectionKey(status.spacesection());
+    }
+};
+
+/**
+ * The key of the messages that are never replaced in the queue of a stream by a later one
+ */
+#define NO_COALESCING_KEY (-1)
+
+/**
+ * The coalescing key of a message isn't known by its publisher, each stream works it out from the message
+ */
+#define UNKNOWN_COALESCING_KEY (-2)
+
+/**
+ * A message being published to many subscribers. It's only copied if a subscriber has to keep it past the publish
+ * (Its client is behind), and then only once for all of them
+ */
+template<typename T>
+class SharedMessage {
+    const T &message;
+
+    std::shared_ptr<const T> shared;
+
+    int coalescingKey;
+
+public:
+    explicit SharedMessage(const T &message, int coalescingKey = UNKNOWN_COALESCING_KEY) :
+            message(message), coalescingKey(coalescingKey) {}
+
+    const T &get() const {
+        return message;
+    }
+
+    bool hasCoalescingKey() const {
+        return coalescingKey != UNKNOWN_COALESCING_KEY;
+    }
+
+    /**
+     * The key worked out by the publisher, for the messages (Like serialized ones) that are costly to read back
+     */
+    int getCoalescingKey() const {
+        return coalescingKey;
+    }
+
+    /**
+     * A reference to the message that outlives the publish
+     */
+    const std::shared_ptr<const T> &share() {
+        if (!shared) {
+            shared = std::make_shared<const T>(message);
+        }
+
+        return shared;
+    }
 };
 
 template<typename Res>
@@ -21,8 +178,22 @@ public:
 
     virtual bool shouldReceive(const Res &res) = 0;
 
+    /**
+     * The key of the messages this subscriber wants (See SubscriptionKey), or NO_SUBSCRIPTION_KEY to see every message
+     */
+    virtual int subscriptionKey() const {
+        return NO_SUBSCRIPTION_KEY;
+    }
+
     virtual void write(const Res &) = 0;
 
+    /**
+     * Write a message that is published to other subscribers as well
+     */
+    virtual void writeShared(SharedMessage<Res> &message) {
+        write(message.get());
+    }
+
     virtual void end() = 0;
 };
 
@@ -40,126 +211,424 @@ public:
 
 };
 
+/**
+ * The subscribers of a message type.
+ *
+ * Subscribers without a key are offered every message, the ones with a key are kept in a map by that key so that a
+ * message only touches the subscribers with the same key (For example, the streams of a single space)
+ *
+ * The lists are copy on write (RCU style): publishers take the current version and iterate it without any lock, while
+ * registering or removing a subscriber builds a new version and swaps it in. Old versions (And the subscribers that
+ * were removed from them) are freed by the last publisher that still holds them, as everything is reference counted,
+ * so publishers never wait for a registration and registrations never wait for a publish.
+ */
 template<typename T>
 class Subscribers {
 
+public:
+    typedef std::shared_ptr<Writable<T>> Subscriber;
+
 private:
-    std::set<Writable<T> *> registeredSubscribers;
+    typedef std::vector<Subscriber> SubscriberList;
 
-    std::mutex lock;
-public:
-    explicit Subscribers() = default;
+    struct Registry {
+        SubscriberList broadcastSubscribers;
+
+        /**
+         * Each list is shared between the versions until its key changes
+         */
+        std::unordered_map<int, std::shared_ptr<const SubscriberList>> keyedSubscribers;
+
+        /**
+         * The key each subscriber was registered with
+         */
+        std::unordered_map<Writable<T> *, int> subscriberKeys;
+    };
+
+    /**
+     * The current version, only accessed with std::atomic_load and std::atomic_store
+     */
+    std::shared_ptr<const Registry> current;
+
+    /**
+     * Serializes the writers (registrations and removals) between themselves, publishers never take it
+     */
+    std::mutex writeLock;
+
+    /**
+     * The metrics of the list, nullptr when it isn't exposed
+     */
+    Histogram *fanoutLatency;
+
+    Counter *delivered;
 
 public:
-    void registerSubscriber(Writable<T> *sub) {
-        std::unique_lock<std::mutex> acqLock(this->lock);
+    /**
+     * @param stream The name the list is exposed under in the metrics, nullptr to leave it out
+     */
+    explicit Subscribers(const char *stream = nullptr) : current(std::make_shared<Registry>()),
+                                                         fanoutLatency(nullptr),
+                                                         delivered(nullptr) {
+        if (stream == nullptr) return;
 
-        registeredSubscribers.insert(std::move(sub));
+        std::string labels = std::string("stream=\"") + stream + "\"";
+
+        fanoutLatency = &Metrics::instance().histogram("parking_fanout_seconds",
+                                                       "The time to write a published message to its subscribers",
+                                                       labels);
+
+        delivered = &Metrics::instance().counter("parking_messages_delivered_total",
+                                                 "The messages written to the subscribers", labels);
+
+        Metrics::instance().observe("parking_subscribers", "The registered subscribers", MetricType::GAUGE,
+                                    [this]() { return (double) size(); }, this, labels);
     }
 
-    void unregisterSubscriber(Writable<T> *sub) {
-        std::unique_lock<std::mutex> acqLock(this->lock);
+    ~Subscribers() {
+        if (fanoutLatency != nullptr) {
+            Metrics::instance().removeObserved(this);
+        }
+    }
+
+    /**
+     * The subscribers a message was delivered to. They are kept alive for as long as this is held, even if they are
+     * removed in the meantime
+     */
+    class Delivery {
+        std::shared_ptr<const Registry> version;
+
+        std::vector<Writable<T> *> receivers;
+
+        friend class Subscribers;
+
+    public:
+        size_t size() const { return receivers.size(); }
 
-        registeredSubscribers.erase(sub);
+        typename std::vector<Writable<T> *>::const_iterator begin() const { return receivers.begin(); }
+
+        typename std::vector<Writable<T> *>::const_iterator end() const { return receivers.end(); }
+    };
+
+private:
+    std::shared_ptr<const Registry> snapshot() const {
+        return std::atomic_load(&current);
     }
 
-    std::unique_ptr<std::vector<Writable<T>*>> sendMessageToSubscribers(const T &message) {
-        std::unique_lock<std::mutex> acqLock(this->lock);
+    /**
+     * Remove a subscriber from a (new, not yet published) version, the write lock must already be held
+     */
+    static void removeFrom(Registry &registry, Writable<T> *sub) {
 
-        auto start = registeredSubscribers.begin();
+        auto key = registry.subscriberKeys.find(sub);
 
-        auto end = registeredSubscribers.end();
+        if (key == registry.subscriberKeys.end()) return;
 
-        auto received = std::make_unique<std::vector<Writable<T>*>>();
+        auto matches = [sub](const Subscriber &other) { return other.get() == sub; };
 
-        while (start != end) {
+        if (key->second == NO_SUBSCRIPTION_KEY) {
+            auto &list = registry.broadcastSubscribers;
 
-            if (*start) {
-                if (!(*start)->isCancelled() && (*start)->shouldReceive(message)) {
-                    (*start)->write(message);
-                    received->push_back(*start);
-                } else {
+            list.erase(std::remove_if(list.begin(), list.end(), matches), list.end());
+        } else {
+            auto keyed = registry.keyedSubscribers.find(key->second);
+
+            if (keyed != registry.keyedSubscribers.end()) {
+                auto list = std::make_shared<SubscriberList>(*keyed->second);
 
-                    std::cout << "Subscriber disconnected" << std::endl;
+                list->erase(std::remove_if(list->begin(), list->end(), matches), list->end());
 
-                    start = registeredSubscribers.erase(start);
-                    end = registeredSubscribers.end();
-                    continue;
+                if (list->empty()) {
+                    registry.keyedSubscribers.erase(keyed);
+                } else {
+                    keyed->second = std::move(list);
                 }
             }
+        }
+
+        registry.subscriberKeys.erase(key);
+    }
 
-            start++;
+    /**
+     * Publish a new version without the given subscribers
+     */
+    void removeSubscribers(const std::vector<Writable<T> *> &subs) {
+
+        std::unique_lock<std::mutex> acqLock(this->writeLock);
+
+        auto next = std::make_shared<Registry>(*snapshot());
+
+        for (auto sub : subs) {
+            removeFrom(*next, sub);
         }
 
-        return std::move(received);
+        std::atomic_store(&current, std::shared_ptr<const Registry>(std::move(next)));
     }
 
-    void endStreamsFor(const T &message) {
+    void recordFanout(std::chrono::steady_clock::time_point start, size_t written) {
+        if (fanoutLatency == nullptr) return;
 
-        std::unique_lock<std::mutex> acqLock(this->lock);
+        fanoutLatency->recordSince(start);
 
-        auto start = registeredSubscribers.begin();
+        delivered->increment(written);
+    }
 
-        auto end = registeredSubscribers.end();
+    template<typename Receive>
+    static void visitReceivers(const SubscriberList &subs, const T &message, const Receive &receive,
+                               std::vector<Writable<T> *> &disconnected) {
 
-        while (start != end) {
+        for (const auto &sub : subs) {
+            if (sub->isCancelled()) {
+                disconnected.push_back(sub.get());
+            } else if (sub->shouldReceive(message)) {
+                receive(sub.get());
+            }
+        }
+    }
 
-            if (*start) {
-                if (!(*start)->isCancelled() && (*start)->shouldReceive(message)) {
-                    (*start)->end();
+    /**
+     * Hand every subscriber of a version that should receive a message to receive, dropping the ones that have
+     * disconnected
+     */
+    template<typename Receive>
+    void forEachReceiver(const Registry &registry, const T &message, const Receive &receive) {
 
-                    start = registeredSubscribers.erase(start);
-                    end = registeredSubscribers.end();
-                    continue;
-                } else {
+        std::vector<Writable<T> *> disconnected;
 
-                    std::cout << "Subscriber disconnected" << std::endl;
+        visitReceivers(registry.broadcastSubscribers, message, receive, disconnected);
 
-                    start = registeredSubscribers.erase(start);
-                    end = registeredSubscribers.end();
-                    continue;
-                }
+        int key = SubscriptionKey<T>::of(message);
+
+        if (key != NO_SUBSCRIPTION_KEY) {
+            auto keyed = registry.keyedSubscribers.find(key);
+
+            if (keyed != registry.keyedSubscribers.end()) {
+                visitReceivers(*keyed->second, message, receive, disconnected);
             }
+        }
+
+        if (!disconnected.empty()) {
+            LOG_DEBUG("Subscribers disconnected", {"count", disconnected.size()});
+
+            removeSubscribers(disconnected);
+        }
+    }
+
+    /**
+     * Collect the subscribers that should receive a message from the current version.
+     * The subscribers are not copied out of the version (Which would touch every reference count), the delivery holds
+     * on to the version instead
+     */
+    std::unique_ptr<Delivery> receiversFor(const T &message) {
+
+        auto delivery = std::make_unique<Delivery>();
+
+        delivery->version = snapshot();
+
+        forEachReceiver(*delivery->version, message, [&delivery](Writable<T> *sub) {
+            delivery->receivers.push_back(sub);
+        });
+
+        return delivery;
+    }
+
+public:
+    /**
+     * Register a subscriber with its current subscription key.
+     * Registering a subscriber again moves it to its new key
+     */
+    void registerSubscriber(const Subscriber &sub) {
+        std::unique_lock<std::mutex> acqLock(this->writeLock);
+
+        auto next = std::make_shared<Registry>(*snapshot());
+
+        removeFrom(*next, sub.get());
+
+        int key = sub->subscriptionKey();
+
+        if (key == NO_SUBSCRIPTION_KEY) {
+            next->broadcastSubscribers.push_back(sub);
+        } else {
+            auto &keyed = next->keyedSubscribers[key];
+
+            auto list = keyed ? std::make_shared<SubscriberList>(*keyed) : std::make_shared<SubscriberList>();
+
+            list->push_back(sub);
+
+            keyed = std::move(list);
+        }
+
+        next->subscriberKeys[sub.get()] = key;
+
+        std::atomic_store(&current, std::shared_ptr<const Registry>(std::move(next)));
+    }
+
+    void unregisterSubscriber(Writable<T> *sub) {
+        removeSubscribers({sub});
+    }
+
+    /**
+     * The number of registered subscribers
+     */
+    size_t size() const {
+        return snapshot()->subscriberKeys.size();
+    }
+
+    /**
+     * Write a message to its subscribers
+     * @return The subscribers it was written to, for the callers that have more to do with them (See publish)
+     */
+    std::unique_ptr<Delivery> sendMessageToSubscribers(const T &message) {
+
+        auto start = std::chrono::steady_clock::now();
+
+        auto received = receiversFor(message);
+
+        SharedMessage<T> shared(message);
+
+        for (auto sub : *received) {
+            sub->writeShared(shared);
+        }
+
+        recordFanout(start, received->size());
+
+        return received;
+    }
+
+    /**
+     * Write a message to its subscribers, without keeping track of them (Or allocating anything) on the way
+     * @param coalescingKey The key that replaces the message in the queues of the streams that are behind, when the
+     * publisher already knows it
+     * @return The number of subscribers it was written to
+     */
+    size_t publish(const T &message, int coalescingKey = UNKNOWN_COALESCING_KEY) {
+
+        auto start = std::chrono::steady_clock::now();
+
+        auto version = snapshot();
+
+        SharedMessage<T> shared(message, coalescingKey);
+
+        size_t written = 0;
+
+        forEachReceiver(*version, message, [&shared, &written](Writable<T> *sub) {
+            sub->writeShared(shared);
+
+            written++;
+        });
 
-            start++;
+        recordFanout(start, written);
+
+        return written;
+    }
+
+    void endStreamsFor(const T &message) {
+
+        auto receivers = receiversFor(message);
+
+        for (auto sub : *receivers) {
+            sub->end();
+        }
+
+        if (receivers->size() > 0) {
+            removeSubscribers(receivers->receivers);
         }
     }
 };
 
 
+/**
+ * The number of completion queues the notification streams are spread over, each polled by its own thread.
+ * 0 uses one for every core
+ */
+#define DEFAULT_NOTIFICATION_QUEUES 0
+
 class ParkingServer;
 
 class ParkingNotificationsImpl final {
 
 private:
 
-    parkingspaces::ParkingNotifications::AsyncService service_;
-    std::unique_ptr<grpc::ServerCompletionQueue> cq_;
+    NotificationsService service_;
+
+    /**
+     * The change and batched streams, which aren't part of the parkingspaces proto
+     */
+    SyncService syncService_;
 
-    std::unique_ptr<Subscribers<parkingspaces::ParkingSpaceStatus>> parkingSpaceSubscribers;
+    /**
+     * The section counts and the section streams, also local to this server
+     */
+    parkingext::ParkingAvailability::AsyncService availabilityService_;
+
+    /**
+     * Every queue has its own acceptors for each stream, so a call is served entirely by the thread of the queue
+     * that accepted it
+     */
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+
+    /**
+     * The parking state subscribers receive the updates already serialized
+     */
+    std::unique_ptr<Subscribers<grpc::ByteBuffer>> parkingSpaceSubscribers;
     std::unique_ptr<Subscribers<parkingspaces::ReserveStatus>> reservationSubscribers;
     std::unique_ptr<Subscribers<parkingspaces::PlateReadRequest>> plateReaders;
+    std::unique_ptr<Subscribers<parkingext::SpaceChanges>> changeSubscribers;
+    std::unique_ptr<Subscribers<parkingspaces::ParkingSpaceStatus>> sectionSubscribers;
+    std::unique_ptr<Subscribers<grpc::ByteBuffer>> batchSubscribers;
+
+    /**
+     * Gathers the updates for the batched streams, it's stopped before the subscribers it flushes to are freed
+     */
+    std::unique_ptr<StatusBatcher> statusBatcher;
+
+    /**
+     * The recent parking space updates, for the change streams to catch up on
+     */
+    std::unique_ptr<ChangeLog> changeLog;
+
+    /**
+     * Held from recording an update to publishing it, so every stream gets the updates in the order of their versions
+     */
+    std::mutex publishLock;
 
     ParkingServer *server;
 
 public:
-    ParkingNotificationsImpl(ParkingServer *);
+    ParkingNotificationsImpl(ParkingServer *, unsigned completionQueues = DEFAULT_NOTIFICATION_QUEUES);
+
+    ~ParkingNotificationsImpl();
 
     void registerService(grpc::ServerBuilder &builder);
 
-    void run();
+    /**
+     * The number of completion queues, each one has to be run on its own thread
+     */
+    size_t queueCount() const;
+
+    /**
+     * Serve the calls of a completion queue, until the server shuts down
+     * @param queue The index of the queue, from 0 to queueCount()
+     */
+    void run(size_t queue);
 
     void publishParkingSpaceUpdate(parkingspaces::ParkingSpaceStatus &status);
 
     void publishReservationUpdate(parkingspaces::ReserveStatus &status);
 
-    std::unique_ptr<std::vector<Writable<parkingspaces::PlateReadRequest>*>>
+    std::unique_ptr<Subscribers<parkingspaces::PlateReadRequest>::Delivery>
         sendPlateReadRequest(parkingspaces::PlateReadRequest &request);
 
     void endReservationStreamsFor(parkingspaces::ReserveStatus &status);
 
+    /**
+     * The number of streams that were disconnected because their client wasn't keeping up with the messages
+     */
+    static uint64_t getSlowSubscribersDisconnected();
+
 private:
-    void HandleRpcs();
+    unsigned completionQueues;
+
+    void HandleRpcs(grpc::ServerCompletionQueue *cq);
 
 };
 
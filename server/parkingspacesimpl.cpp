@@ -1,53 +1,342 @@
 #include "parkingspacesimpl.h"
+#include "eventarena.h"
+
+using namespace parkingspaces;
+
+enum UnaryCallStatus {
+    U_CREATE, U_PROCESS, U_FINISHED
+};
+
+enum StreamCallStatus {
+    S_CREATE, S_LOADING, S_WRITING, S_FINISHED
+};
+
+/**
+ * A unary call of the ParkingSpaces service.
+ * The completion queue thread only accepts it, the request is handled and answered from the worker pool
+ * @tparam Req The type of the request made by the client
+ * @tparam Res The type of the response
+ */
+template<class Req, class Res>
+class UnaryCallData : public RPCContextBase {
+protected:
+    ParkingSpacesImpl *impl;
+
+    ParkingSpaces::AsyncService *service_;
+
+    grpc::ServerCompletionQueue *cq_;
+
+    grpc::ServerContext ctx_;
+
+    Req request;
+
+    Res response;
+
+    grpc::ServerAsyncResponseWriter<Res> responder_;
+
+    UnaryCallStatus status_;
+
+public:
+    UnaryCallData(ParkingSpacesImpl *impl, ParkingSpaces::AsyncService *service, grpc::ServerCompletionQueue *cq)
+            : impl(impl),
+              service_(service),
+              cq_(cq),
+              responder_(&ctx_),
+              status_(U_CREATE) {}
+
+    virtual void registerRequest() = 0;
+
+    virtual void initializeNewRq() = 0;
+
+    /**
+     * Handle the request and fill the response, called on the worker pool
+     */
+    virtual grpc::Status handle() = 0;
+
+    void Proceed(bool ok) override {
+
+        switch (status_) {
+            case U_CREATE:
+
+                status_ = U_PROCESS;
+
+                registerRequest();
+
+                break;
+            case U_PROCESS:
+
+                if (!ok) {
+                    //The server is shutting down before a client took this call
+                    delete this;
+
+                    break;
+                }
+
+                initializeNewRq();
+
+                status_ = U_FINISHED;
+
+                impl->getWorkers()->submit([this]() {
+                    auto result = handle();
+
+                    responder_.Finish(response, result, this);
+                });
+
+                break;
+            case U_FINISHED:
+
+                delete this;
+
+                break;
+        }
+    }
+};
+
+class CheckReserveStatusData : public UnaryCallData<LicensePlate, ParkingSpaceStatus> {
+public:
+    CheckReserveStatusData(ParkingSpacesImpl *impl, ParkingSpaces::AsyncService *service,
+                           grpc::ServerCompletionQueue *cq) : UnaryCallData(impl, service, cq) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestcheckReserveStatus(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new CheckReserveStatusData(impl, service_, cq_);
+    }
+
+    grpc::Status handle() override {
+        return impl->checkReserveStatus(&request, &response);
+    }
+};
+
+class ReserveSpaceData : public UnaryCallData<ParkingSpaceReservation, ReservationResponse> {
+public:
+    ReserveSpaceData(ParkingSpacesImpl *impl, ParkingSpaces::AsyncService *service,
+                     grpc::ServerCompletionQueue *cq) : UnaryCallData(impl, service, cq) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestattemptToReserveSpace(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new ReserveSpaceData(impl, service_, cq_);
+    }
+
+    grpc::Status handle() override {
+        return impl->attemptToReserveSpace(&request, &response);
+    }
+};
+
+class CancelReservationData : public UnaryCallData<ReservationCancelRequest, ReservationCancelResponse> {
+public:
+    CancelReservationData(ParkingSpacesImpl *impl, ParkingSpaces::AsyncService *service,
+                          grpc::ServerCompletionQueue *cq) : UnaryCallData(impl, service, cq) {
+        Proceed(true);
+    }
+
+    void registerRequest() override {
+        service_->RequestcancelSpaceReservation(&ctx_, &request, &responder_, cq_, cq_, this);
+    }
+
+    void initializeNewRq() override {
+        new CancelReservationData(impl, service_, cq_);
+    }
+
+    grpc::Status handle() override {
+        return impl->cancelSpaceReservation(&request, &response);
+    }
+};
+
+/**
+ * The fetchAllParkingStates stream. The states are written from the cached snapshot of the lot one at a time
+ * (gRPC only allows one write in flight) as each write completes. When the snapshot isn't up to date it's loaded
+ * on the worker pool first
+ */
+class FetchAllStatesData : public RPCContextBase {
+private:
+    ParkingSpacesImpl *impl;
+
+    SpacesService *service_;
+
+    grpc::ServerCompletionQueue *cq_;
+
+    grpc::ServerContext ctx_;
+
+    /**
+     * The (serialized) ParkingSpacesRq, as this stream is raw
+     */
+    grpc::ByteBuffer request;
+
+    grpc::ServerAsyncWriter<grpc::ByteBuffer> responder_;
+
+    std::shared_ptr<const LotSnapshot::Messages> statuses;
+
+    size_t written;
+
+    StreamCallStatus status_;
+
+public:
+    FetchAllStatesData(ParkingSpacesImpl *impl, SpacesService *service,
+                       grpc::ServerCompletionQueue *cq) : impl(impl),
+                                                          service_(service),
+                                                          cq_(cq),
+                                                          responder_(&ctx_),
+                                                          written(0),
+                                                          status_(S_CREATE) {
+        Proceed(true);
+    }
+
+    void Proceed(bool ok) override {
+
+        switch (status_) {
+            case S_CREATE:
+
+                status_ = S_LOADING;
+
+                service_->RequestfetchAllParkingStates(&ctx_, &request, &responder_, cq_, cq_, this);
+
+                break;
+            case S_LOADING:
+
+                if (!ok) {
+                    delete this;
+
+                    break;
+                }
+
+                new FetchAllStatesData(impl, service_, cq_);
+
+                status_ = S_WRITING;
+
+                statuses = impl->getLotSnapshot()->cached();
+
+                if (statuses) {
+                    writeNext();
+
+                    break;
+                }
+
+                impl->getWorkers()->submit([this]() {
+                    auto result = impl->fetchAllParkingStates(&request, &statuses);
+
+                    if (!result.ok()) {
+                        status_ = S_FINISHED;
+
+                        responder_.Finish(result, this);
+                    } else {
+                        writeNext();
+                    }
+                });
+
+                break;
+            case S_WRITING:
+
+                if (!ok) {
+                    //The client is gone
+                    status_ = S_FINISHED;
+
+                    responder_.Finish(grpc::Status::CANCELLED, this);
+
+                    break;
+                }
+
+                writeNext();
+
+                break;
+            case S_FINISHED:
+
+                delete this;
+
+                break;
+        }
+    }
+
+private:
+    void writeNext() {
+        if (written < statuses->size()) {
+            responder_.Write((*statuses)[written++], this);
+        } else {
+            status_ = S_FINISHED;
+
+            responder_.Finish(grpc::Status::OK, this);
+        }
+    }
+};
 
 ParkingSpacesImpl::~ParkingSpacesImpl() {
     this->db.reset();
 }
 
-using namespace parkingspaces;
+void ParkingSpacesImpl::registerService(grpc::ServerBuilder &builder) {
 
-grpc::Status ParkingSpacesImpl::fetchAllParkingStates(::grpc::ServerContext *context, const ::ParkingSpacesRq *request,
-                                                      ::grpc::ServerWriter<::ParkingSpaceStatus> *writer) {
+    builder.RegisterService(&service_);
 
-    auto spaceStates = this->db->fetchAllSpaceStates();
+    for (unsigned i = 0; i < completionQueues; i++) {
+        cqs_.push_back(builder.AddCompletionQueue());
+    }
+}
 
-    for (const auto &space : *spaceStates) {
-        parkingspaces::ParkingSpaceStatus status;
+size_t ParkingSpacesImpl::queueCount() const {
+    return cqs_.size();
+}
+
+void ParkingSpacesImpl::run(size_t queue) {
+    HandleRpcs(cqs_[queue].get());
+}
 
-        status.set_spaceid(space.getSpaceId());
+void ParkingSpacesImpl::HandleRpcs(grpc::ServerCompletionQueue *cq) {
 
-        status.set_spacesection(space.getSection());
+    new FetchAllStatesData(this, &service_, cq);
+    new CheckReserveStatusData(this, &service_, cq);
+    new ReserveSpaceData(this, &service_, cq);
+    new CancelReservationData(this, &service_, cq);
 
-        status.set_spacestate(space.getState());
+    void *tag;
+    bool ok;
 
-        writer->Write(status);
+    while (cq->Next(&tag, &ok)) {
+        static_cast<RPCContextBase *>(tag)->Proceed(ok);
     }
+}
+
+grpc::Status ParkingSpacesImpl::fetchAllParkingStates(const grpc::ByteBuffer *request,
+                                                      std::shared_ptr<const LotSnapshot::Messages> *statuses) {
+
+    *statuses = this->lotSnapshot.get();
 
     return grpc::Status::OK;
 }
 
 grpc::Status
-ParkingSpacesImpl::attemptToReserveSpace(::grpc::ServerContext *context, const ::ParkingSpaceReservation *request,
-                                         ::ReservationResponse *response) {
+ParkingSpacesImpl::attemptToReserveSpace(const ::ParkingSpaceReservation *request, ::ReservationResponse *response) {
 
     bool res = this->db->attemptToReserveSpot(request->spaceid(), request->licenceplate());
 
     response->set_spaceid(request->spaceid());
 
-    std::cout << "Reserve result: " << res << std::endl;
+    LOG_DEBUG("Reserve result", {"space", request->spaceid()}, {"reserved", res});
 
     auto state = this->db->getStateForSpace(request->spaceid());
 
     if (res) {
         response->set_response(parkingspaces::ReserveState::SUCCESSFUL);
 
-        parkingspaces::ParkingSpaceStatus status;
+        EventArena arena;
 
-        status.set_spaceid(state->getSpaceId());
-        status.set_spacesection(state->getSection());
-        status.set_spacestate(state->getState());
+        auto status = arena.create<parkingspaces::ParkingSpaceStatus>();
 
-        notifications->publishParkingSpaceUpdate(status);
+        status->set_spaceid(state->getSpaceId());
+        status->set_spacesection(state->getSection());
+        status->set_spacestate(state->getState());
+
+        notifications->publishParkingSpaceUpdate(*status);
+
+        this->timers->schedule(state->getSpaceId(), state->getLastChange() + RESERVATION_EXPIRATION * 60);
 
         this->conn->notifyArduino(state->getSpaceId(), true);
     } else {
@@ -67,8 +356,7 @@ ParkingSpacesImpl::attemptToReserveSpace(::grpc::ServerContext *context, const :
     return grpc::Status::OK;
 }
 
-grpc::Status ParkingSpacesImpl::cancelSpaceReservation(::grpc::ServerContext *context,
-                                                       const ::parkingspaces::ReservationCancelRequest *request,
+grpc::Status ParkingSpacesImpl::cancelSpaceReservation(const ::parkingspaces::ReservationCancelRequest *request,
                                                        ::parkingspaces::ReservationCancelResponse *response) {
 
     auto state = this->db->getReservationForLicensePlate(request->licenseplate());
@@ -81,13 +369,15 @@ grpc::Status ParkingSpacesImpl::cancelSpaceReservation(::grpc::ServerContext *co
         if (res) {
             response->set_cancelstate(parkingspaces::ReserveCancelState::CANCELLED);
 
-            parkingspaces::ParkingSpaceStatus status;
+            EventArena arena;
+
+            auto status = arena.create<parkingspaces::ParkingSpaceStatus>();
 
-            status.set_spaceid(state->getSpaceId());
-            status.set_spacestate(parkingspaces::SpaceStates::FREE);
-            status.set_spacesection(state->getSection());
+            status->set_spaceid(state->getSpaceId());
+            status->set_spacestate(parkingspaces::SpaceStates::FREE);
+            status->set_spacesection(state->getSection());
 
-            this->notifications->publishParkingSpaceUpdate(status);
+            this->notifications->publishParkingSpaceUpdate(*status);
 
             parkingspaces::ReserveStatus reserveStatus;
 
@@ -110,7 +400,7 @@ grpc::Status ParkingSpacesImpl::cancelSpaceReservation(::grpc::ServerContext *co
 }
 
 grpc::Status
-ParkingSpacesImpl::checkReserveStatus(::grpc::ServerContext *context, const ::parkingspaces::LicensePlate *request,
+ParkingSpacesImpl::checkReserveStatus(const ::parkingspaces::LicensePlate *request,
                                       ::parkingspaces::ParkingSpaceStatus *response) {
     auto state = this->db->getReservationForLicensePlate(request->licenseplate());
 
@@ -130,6 +420,10 @@ ParkingSpacesImpl::checkReserveStatus(::grpc::ServerContext *context, const ::pa
 
 ParkingSpacesImpl::ParkingSpacesImpl(std::shared_ptr<Database> db,
                                      std::shared_ptr<ParkingNotificationsImpl> notification,
-                                     std::shared_ptr<ArduinoConnection> conn)
+                                     std::shared_ptr<ArduinoConnection> conn,
+                                     std::shared_ptr<ReservationTimers> timers,
+                                     unsigned completionQueues,
+                                     unsigned workerThreads)
         : db(std::move(db)), notifications(std::move(notification)),
-          conn(std::move(conn)) {}
\ No newline at end of file
+          conn(std::move(conn)), timers(std::move(timers)),
+          completionQueues(completionQueues), workers(workerThreads), lotSnapshot(this->db) {}
\ No newline at end of file
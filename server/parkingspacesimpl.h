@@ -4,33 +4,98 @@
 #include "parkingspaces.grpc.pb.h"
 #include "../database/database.h"
 #include "parkingnotifications.h"
+#include "reservationtimers.h"
+#include "lotsnapshot.h"
+#include "workerpool.h"
 #include "../conn_arduino/arduino_notification.h"
 
-class ParkingSpacesImpl : public parkingspaces::ParkingSpaces::Service {
+/**
+ * The number of completion queues (Each with its own thread) the ParkingSpaces calls are accepted on.
+ * The requests themselves are handled on the worker pool, so the queue threads only do the network IO
+ */
+#define DEFAULT_SPACES_QUEUES 1
+
+/**
+ * The ParkingSpaces service, with the fetchAllParkingStates stream registered as raw so the cached snapshot can be
+ * written as it is, already serialized
+ */
+typedef parkingspaces::ParkingSpaces::WithRawMethod_fetchAllParkingStates<
+        parkingspaces::ParkingSpaces::AsyncService> SpacesService;
+
+/**
+ * The ParkingSpaces service, served asynchronously: the calls are accepted on completion queues and handled on a
+ * worker pool, so no thread is held by a request while it waits on the database or on Firebase
+ */
+class ParkingSpacesImpl {
 
 private:
     std::shared_ptr<Database> db;
     std::shared_ptr<ParkingNotificationsImpl> notifications;
     std::shared_ptr<ArduinoConnection> conn;
+    std::shared_ptr<ReservationTimers> timers;
+
+    SpacesService service_;
+
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+
+    unsigned completionQueues;
+
+    WorkerPool workers;
+
+    LotSnapshot lotSnapshot;
 
 public:
     ParkingSpacesImpl(std::shared_ptr<Database> db, std::shared_ptr<ParkingNotificationsImpl> notifications,
-                      std::shared_ptr<ArduinoConnection> conn);
+                      std::shared_ptr<ArduinoConnection> conn, std::shared_ptr<ReservationTimers> timers,
+                      unsigned completionQueues = DEFAULT_SPACES_QUEUES,
+                      unsigned workerThreads = DEFAULT_WORKER_THREADS);
+
+    ~ParkingSpacesImpl();
 
-    ~ParkingSpacesImpl() override;
+    void registerService(grpc::ServerBuilder &builder);
 
-    grpc::Status fetchAllParkingStates(::grpc::ServerContext *context, const parkingspaces::ParkingSpacesRq *request,
-                                       ::grpc::ServerWriter<parkingspaces::ParkingSpaceStatus> *writer) override;
+    /**
+     * The number of completion queues, each one has to be run on its own thread
+     */
+    size_t queueCount() const;
 
-    grpc::Status checkReserveStatus(::grpc::ServerContext *context, const ::parkingspaces::LicensePlate *request,
-                                    ::parkingspaces::ParkingSpaceStatus *response) override;
+    /**
+     * Serve the calls of a completion queue, until the server shuts down
+     * @param queue The index of the queue, from 0 to queueCount()
+     */
+    void run(size_t queue);
 
-    grpc::Status attemptToReserveSpace(::grpc::ServerContext *context, const parkingspaces::ParkingSpaceReservation *request,
-                                       parkingspaces::ReservationResponse *response) override;
+    /*
+     * The handlers of the calls, these run on the worker pool
+     */
+
+    /**
+     * @param request The (serialized) ParkingSpacesRq, as this stream is raw
+     * @param statuses The serialized state of every space, shared with the other calls
+     */
+    grpc::Status fetchAllParkingStates(const grpc::ByteBuffer *request,
+                                       std::shared_ptr<const LotSnapshot::Messages> *statuses);
+
+    grpc::Status checkReserveStatus(const ::parkingspaces::LicensePlate *request,
+                                    ::parkingspaces::ParkingSpaceStatus *response);
+
+    grpc::Status attemptToReserveSpace(const parkingspaces::ParkingSpaceReservation *request,
+                                       parkingspaces::ReservationResponse *response);
 
     grpc::Status
-    cancelSpaceReservation(::grpc::ServerContext *context, const ::parkingspaces::ReservationCancelRequest *request,
-                           ::parkingspaces::ReservationCancelResponse *response) override;
+    cancelSpaceReservation(const ::parkingspaces::ReservationCancelRequest *request,
+                           ::parkingspaces::ReservationCancelResponse *response);
+
+    WorkerPool *getWorkers() {
+        return &workers;
+    }
+
+    LotSnapshot *getLotSnapshot() {
+        return &lotSnapshot;
+    }
+
+private:
+    void HandleRpcs(grpc::ServerCompletionQueue *cq);
 
 };
 
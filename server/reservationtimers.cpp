@@ -0,0 +1,96 @@
+#include "reservationtimers.h"
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+
+ReservationTimers::ReservationTimers(int64_t now) : currentTick(now) {}
+
+void ReservationTimers::schedule(int spaceID, int64_t deadline) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    place({spaceID, deadline});
+}
+
+void ReservationTimers::place(const ReservationTimers::Timer &timer) {
+
+    int64_t delta = timer.deadline - this->currentTick;
+
+    if (delta <= 0) {
+        this->due.push_back(timer);
+
+        return;
+    }
+
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+
+        //The amount of seconds this level (and the ones below it) covers
+        if (delta < ((int64_t) 1 << (WHEEL_BITS * (level + 1)))) {
+
+            int slot = (int) ((timer.deadline >> (WHEEL_BITS * level)) & SLOT_MASK);
+
+            this->wheel[level][slot].push_back(timer);
+
+            return;
+        }
+    }
+
+    this->overflow.push_back(timer);
+}
+
+void ReservationTimers::cascade(int level, int64_t tick) {
+
+    int slot = (int) ((tick >> (WHEEL_BITS * level)) & SLOT_MASK);
+
+    std::vector<Timer> timers;
+
+    timers.swap(this->wheel[level][slot]);
+
+    for (const auto &timer : timers) {
+        place(timer);
+    }
+}
+
+std::vector<ReservationTimers::Timer> ReservationTimers::advance(int64_t now) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    std::vector<Timer> expired;
+
+    expired.swap(this->due);
+
+    while (this->currentTick < now) {
+
+        int64_t tick = ++this->currentTick;
+
+        if ((tick & (((int64_t) 1 << (WHEEL_BITS * 2)) - 1)) == 0) {
+            //The top level moves to its next slot (Every 4096 ticks, it only wraps every 2^18), the horizon moved with
+            //it, so the timers that were too far away are placed again in case they fit now
+            std::vector<Timer> far;
+
+            far.swap(this->overflow);
+
+            for (const auto &timer : far) {
+                place(timer);
+            }
+
+            cascade(2, tick);
+        }
+
+        if ((tick & SLOT_MASK) == 0) {
+            cascade(1, tick);
+        }
+
+        auto &slot = this->wheel[0][tick & SLOT_MASK];
+
+        expired.insert(expired.end(), slot.begin(), slot.end());
+
+        slot.clear();
+
+        //Timers that were placed in the slot of their deadline by a cascade on this tick
+        expired.insert(expired.end(), this->due.begin(), this->due.end());
+
+        this->due.clear();
+    }
+
+    return expired;
+}
@@ -0,0 +1,78 @@
+#ifndef RASPBERRY_RESERVATIONTIMERS_H
+#define RASPBERRY_RESERVATIONTIMERS_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * The number of slots in each level of the wheel (Must be a power of 2)
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 3
+
+/**
+ * The deadlines of the reservations, kept in a hierarchical timer wheel with a resolution of one second.
+ *
+ * The first level has a slot for each of the next 64 seconds, the second for each of the next 64 blocks of 64 seconds
+ * And the third for blocks of 4096 seconds (About 3 days in total). Timers are moved down a level when their block
+ * comes up, so scheduling and expiring a reservation is O(1) no matter how many there are.
+ */
+class ReservationTimers {
+
+public:
+    struct Timer {
+        int spaceID;
+
+        /**
+         * In seconds since the epoch
+         */
+        int64_t deadline;
+    };
+
+private:
+    std::vector<Timer> wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+    /**
+     * Timers further away than the wheel covers, and timers that are already due
+     */
+    std::vector<Timer> overflow, due;
+
+    /**
+     * The last second the wheel was advanced to
+     */
+    int64_t currentTick;
+
+    std::mutex lock;
+
+public:
+    explicit ReservationTimers(int64_t now);
+
+    /**
+     * Schedule a timer for a reservation
+     * @param spaceID
+     * @param deadline The time the reservation expires, in seconds since the epoch
+     */
+    void schedule(int spaceID, int64_t deadline);
+
+    /**
+     * Advance the wheel up to a time
+     * @param now In seconds since the epoch
+     * @return The timers whose deadline has passed
+     */
+    std::vector<Timer> advance(int64_t now);
+
+private:
+    /**
+     * Place a timer in the wheel relative to the current tick, the lock must already be held
+     */
+    void place(const Timer &timer);
+
+    /**
+     * Move the timers of a slot down to the lower levels, the lock must already be held
+     */
+    void cascade(int level, int64_t tick);
+};
+
+#endif //RASPBERRY_RESERVATIONTIMERS_H
@@ -0,0 +1,133 @@
+#include "sectioncounters.h"
+#include <algorithm>
+
+void SectionCounters::load(const std::vector<SpaceState> &states) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    this->spaces.clear();
+    this->counts.clear();
+    this->sectionSpaces.clear();
+
+    for (const auto &space : states) {
+        this->spaces[space.getSpaceId()] = {space.getSection(), space.getState()};
+
+        counterOf(this->counts[space.getSection()], space.getState())++;
+
+        this->sectionSpaces[space.getSection()].insert(space.getSpaceId());
+    }
+}
+
+void SectionCounters::update(int spaceID, const std::string &section, parkingspaces::SpaceStates state) {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    auto existing = this->spaces.find(spaceID);
+
+    if (existing != this->spaces.end()) {
+        Space &space = existing->second;
+
+        if (space.section == section && space.state == state) return;
+
+        counterOf(this->counts[space.section], space.state)--;
+
+        if (space.section != section) {
+            this->sectionSpaces[space.section].erase(spaceID);
+            this->sectionSpaces[section].insert(spaceID);
+        }
+
+        space.section = section;
+        space.state = state;
+    } else {
+        this->spaces[spaceID] = {section, state};
+
+        this->sectionSpaces[section].insert(spaceID);
+    }
+
+    counterOf(this->counts[section], state)++;
+}
+
+SectionCount SectionCounters::countFor(const std::string &section) const {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    if (section.empty()) {
+        SectionCount total;
+
+        for (const auto &count : this->counts) {
+            total.free += count.second.free;
+            total.occupied += count.second.occupied;
+            total.reserved += count.second.reserved;
+        }
+
+        return total;
+    }
+
+    auto count = this->counts.find(section);
+
+    return count == this->counts.end() ? SectionCount() : count->second;
+}
+
+std::vector<std::pair<std::string, SectionCount>> SectionCounters::allCounts() const {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    return std::vector<std::pair<std::string, SectionCount>>(this->counts.begin(), this->counts.end());
+}
+
+std::vector<parkingspaces::ParkingSpaceStatus> SectionCounters::spacesIn(const std::string &section) const {
+
+    std::unique_lock<std::mutex> acqLock(this->lock);
+
+    std::vector<parkingspaces::ParkingSpaceStatus> result;
+
+    if (section.empty()) {
+        result.reserve(this->spaces.size());
+
+        for (const auto &space : this->spaces) {
+            parkingspaces::ParkingSpaceStatus status;
+
+            status.set_spaceid(space.first);
+            status.set_spacesection(space.second.section);
+            status.set_spacestate(space.second.state);
+
+            result.push_back(std::move(status));
+        }
+
+        std::sort(result.begin(), result.end(), [](const parkingspaces::ParkingSpaceStatus &a,
+                                                   const parkingspaces::ParkingSpaceStatus &b) {
+            return a.spaceid() < b.spaceid();
+        });
+
+        return result;
+    }
+
+    auto ids = this->sectionSpaces.find(section);
+
+    if (ids == this->sectionSpaces.end()) return result;
+
+    result.reserve(ids->second.size());
+
+    for (int spaceID : ids->second) {
+        parkingspaces::ParkingSpaceStatus status;
+
+        status.set_spaceid(spaceID);
+        status.set_spacesection(section);
+        status.set_spacestate(this->spaces.at(spaceID).state);
+
+        result.push_back(std::move(status));
+    }
+
+    return result;
+}
+
+uint32_t &SectionCounters::counterOf(SectionCount &count, parkingspaces::SpaceStates state) {
+    switch (state) {
+        case parkingspaces::OCCUPIED:
+            return count.occupied;
+        case parkingspaces::RESERVED:
+            return count.reserved;
+        default:
+            return count.free;
+    }
+}
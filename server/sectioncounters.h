@@ -0,0 +1,73 @@
+#ifndef RASPBERRY_SECTIONCOUNTERS_H
+#define RASPBERRY_SECTIONCOUNTERS_H
+
+#include "parkingspaces.pb.h"
+#include "../database/database.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SectionCount {
+    uint32_t free = 0, occupied = 0, reserved = 0;
+};
+
+/**
+ * The number of spaces in each state of every section, kept up to date with every published change so the counts
+ * are read without going through the lot (Or the database).
+ *
+ * The state and section of every space are kept as well, to know what a change moves the space out of and to list
+ * the spaces of a section
+ */
+class SectionCounters {
+
+private:
+    struct Space {
+        std::string section;
+
+        parkingspaces::SpaceStates state;
+    };
+
+    std::unordered_map<int, Space> spaces;
+
+    /**
+     * Ordered, so the sections are listed by name
+     */
+    std::map<std::string, SectionCount> counts;
+
+    std::unordered_map<std::string, std::set<int>> sectionSpaces;
+
+    mutable std::mutex lock;
+
+public:
+    /**
+     * Replace the counts with the ones of the given states
+     */
+    void load(const std::vector<SpaceState> &states);
+
+    /**
+     * Move a space to its new state (And section), spaces we haven't seen are added
+     */
+    void update(int spaceID, const std::string &section, parkingspaces::SpaceStates state);
+
+    /**
+     * @param section The section, empty for the whole lot
+     * @return The counts of the section, all 0 when it has no spaces
+     */
+    SectionCount countFor(const std::string &section) const;
+
+    std::vector<std::pair<std::string, SectionCount>> allCounts() const;
+
+    /**
+     * The current state of every space in the section (Every space of the lot when it's empty), by space id
+     */
+    std::vector<parkingspaces::ParkingSpaceStatus> spacesIn(const std::string &section) const;
+
+private:
+    static uint32_t &counterOf(SectionCount &count, parkingspaces::SpaceStates state);
+};
+
+#endif //RASPBERRY_SECTIONCOUNTERS_H
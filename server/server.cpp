@@ -1,9 +1,11 @@
 #include "server.h"
+#include "eventarena.h"
+#include "../metrics/metrics.h"
 #include <thread>
 #include <fstream>
 #include <sstream>
+#include <ctime>
 
-#define PERIOD 5
 #define CERT_STORAGE "./ssl/"
 #define PRIV_KEY "service.key"
 #define CERT_FILE "service.pem"
@@ -11,48 +13,114 @@
 
 using namespace parkingspaces;
 
-void startNotificationServer(ParkingNotificationsImpl *notif) {
-    notif->run();
+static Counter &spaceChanges = Metrics::instance().counter("parking_space_changes_total",
+                                                           "The changes of occupation of the spaces");
+
+static RateMeter &spaceChangeRate = Metrics::instance().rate("parking_space_changes_per_second",
+                                                             "The changes of occupation of the spaces per second, "
+                                                             "over the last 10 seconds");
+
+static Histogram &plateReadLatency = Metrics::instance().histogram("parking_plate_read_seconds",
+                                                                   "The time from requesting the plate of a car "
+                                                                   "that parked to receiving it");
+
+void startNotificationServer(ParkingNotificationsImpl *notif, size_t queue) {
+    notif->run(queue);
+}
+
+void startSpacesServer(ParkingSpacesImpl *spaces, size_t queue) {
+    spaces->run(queue);
 }
 
 [[noreturn]] void startExpirationServer(ParkingServer *server) {
 
     while (true) {
-        std::cout << "Running expiration check" << std::endl;
 
-        Database *db = server->getDatabase();
+        auto expired = server->getReservationTimers()->advance(time(nullptr));
+
+        for (const auto &timer : expired) {
+            server->expireReservation(timer.spaceID);
+        }
+
+        //Wake up on the next second, so reservations expire within a second of their deadline
+        auto now = std::chrono::system_clock::now();
+
+        std::this_thread::sleep_until(std::chrono::time_point_cast<std::chrono::seconds>(now) + std::chrono::seconds(1));
+    }
+}
+
+void ParkingServer::expireReservation(int spaceID) {
 
-        auto states = db->getExpiredReserveStates();
+    auto space = this->db->getStateForSpace(spaceID);
 
-        std::cout << "Expired: " << states->size() << std::endl;
-        for (const auto &space : *states) {
+    if (!space || space->getState() != RESERVED) {
+        //The reservation was already cancelled or concluded
+        return;
+    }
 
-            bool result = db->cancelReservationForSpot(space.getSpaceId());
+    if (space->getLastChange() + RESERVATION_EXPIRATION * 60 > time(nullptr)) {
+        //The space was reserved again after this timer was scheduled, that reservation has its own timer
+        return;
+    }
 
-            if (result) {
-                ReserveStatus status;
+    bool result = this->db->cancelReservationForSpot(spaceID);
 
-                status.set_spaceid(space.getSpaceId());
-                status.set_state(ReservationState::RESERVE_CANCELLED_EXPIRED);
+    if (result) {
+        ReserveStatus status;
 
-                server->getNotifications()->publishReservationUpdate(status);
+        status.set_spaceid(spaceID);
+        status.set_state(ReservationState::RESERVE_CANCELLED_EXPIRED);
 
-                server->getArduinoConn()->notifyArduino(space.getSpaceId(), false);
+        this->notifications->publishReservationUpdate(status);
 
-                std::cout << "Expired space reserve for " << space.getSpaceId() << std::endl;
-            }
-        }
+        EventArena arena;
 
-        std::this_thread::sleep_for(std::chrono::minutes(PERIOD));
+        auto spaceStatus = arena.create<ParkingSpaceStatus>();
+
+        spaceStatus->set_spaceid(spaceID);
+        spaceStatus->set_spacesection(space->getSection());
+        spaceStatus->set_spacestate(SpaceStates::FREE);
+
+        this->notifications->publishParkingSpaceUpdate(*spaceStatus);
+
+        this->connection->notifyArduino(spaceID, false);
+
+        LOG_INFO("Expired space reserve", {"space", spaceID});
     }
 }
 
+void ParkingServer::loadReservationTimers() {
+
+    auto states = this->db->fetchAllSpaceStates();
+
+    int reservations = 0;
+
+    for (const auto &space : *states) {
+        if (space.getState() == RESERVED) {
+            this->reservationTimers->schedule(space.getSpaceId(),
+                                              space.getLastChange() + RESERVATION_EXPIRATION * 60);
+
+            reservations++;
+        }
+    }
+
+    LOG_INFO("Scheduled reservation timers", {"count", reservations});
+}
+
 void ParkingServer::wait() {
     server->Wait();
 }
 
 void ParkingServer::startNotifications() {
-    this->notifThread = std::thread(startNotificationServer, notifications.get());
+    for (size_t queue = 0; queue < notifications->queueCount(); queue++) {
+        this->notifThreads.emplace_back(startNotificationServer, notifications.get(), queue);
+    }
+}
+
+void ParkingServer::startSpaces() {
+    for (size_t queue = 0; queue < spaces->queueCount(); queue++) {
+        this->spacesThreads.emplace_back(startSpacesServer, spaces.get(), queue);
+    }
 }
 
 void ParkingServer::startExpirations() {
@@ -61,43 +129,124 @@ void ParkingServer::startExpirations() {
 
 void ParkingServer::receiveParkingSpaceNotification(int spaceID, bool occupied) {
 
-    std::cout << "Updating space " << spaceID << " to " << (occupied ? SpaceStates::OCCUPIED : SpaceStates::FREE)
-              << std::endl;
+    std::unique_lock<std::mutex> sensorsLock(this->sensorLock);
+
+    LOG_DEBUG("Updating space", {"space", spaceID}, {"state", occupied ? SpaceStates::OCCUPIED : SpaceStates::FREE});
 
     auto space = this->db->updateSpaceState(spaceID, occupied ? SpaceStates::OCCUPIED : SpaceStates::FREE,
                                             std::string());
 
     if (!space) {
 
-        std::cout << "Inserting space..." << std::endl;
+        LOG_INFO("Inserting space", {"space", spaceID});
+
+        this->db->insertSpace(spaceID, DEFAULT_SECTION);
+
+        space = this->db->updateSpaceState(spaceID, occupied ? SpaceStates::OCCUPIED : SpaceStates::FREE,
+                                           std::string());
+
+        if (!space) {
+            LOG_ERROR("Failed to insert space", {"space", spaceID});
+
+            return;
+        }
+    }
+
+    publishSpaceOccupation(spaceID, occupied, *space);
+}
+
+void ParkingServer::receiveParkingSpaceSnapshot(const std::vector<SpaceReading> &readings) {
 
-        this->db->insertSpace(spaceID, "A");
+    std::unique_lock<std::mutex> sensorsLock(this->sensorLock);
 
-        receiveParkingSpaceNotification(spaceID, occupied);
+    std::vector<SpaceUpdate> updates;
+
+    std::vector<bool> occupation;
+
+    for (const auto &reading : readings) {
+
+        if (reading.temperature != NO_TEMPERATURE && reading.temperature > TEMP_LIMIT) {
+            publishTemperature(reading.spaceID, reading.temperature);
+        }
+
+        auto current = this->db->getStateForSpace(reading.spaceID);
+
+        //Spaces that are already in the state the sensor reports are not touched, so reconnecting to the
+        //Sensors does not clear the plates of parked cars or the reserved spaces that are still empty
+        if (current) {
+            if (reading.occupied && current->getState() == SpaceStates::OCCUPIED) continue;
+
+            if (!reading.occupied && current->getState() != SpaceStates::OCCUPIED) continue;
+        }
+
+        updates.push_back({static_cast<unsigned int>(reading.spaceID),
+                           reading.occupied ? SpaceStates::OCCUPIED : SpaceStates::FREE,
+                           std::string(), DEFAULT_SECTION});
+
+        occupation.push_back(reading.occupied);
+    }
+
+    LOG_INFO("Applying snapshot", {"spaces", readings.size()}, {"changed", updates.size()});
+
+    if (updates.empty()) return;
+
+    auto prevStates = this->db->applySpaceUpdates(updates);
+
+    if (prevStates.empty()) {
+        //Nothing was persisted, so there's nothing to publish
+        LOG_ERROR("Failed to apply snapshot", {"changed", updates.size()});
 
         return;
     }
 
-    ParkingSpaceStatus status;
+    for (size_t i = 0; i < prevStates.size(); i++) {
+        publishSpaceOccupation(prevStates[i].getSpaceId(), occupation[i], prevStates[i]);
+    }
+}
+
+void ParkingServer::publishSpaceOccupation(int spaceID, bool occupied, const SpaceState &prevState) {
 
-    status.set_spaceid(spaceID);
-    status.set_spacesection(space->getSection());
-    status.set_spacestate(occupied ? SpaceStates::OCCUPIED : SpaceStates::FREE);
+    spaceChanges.increment();
+    spaceChangeRate.mark();
 
-    this->notifications->publishParkingSpaceUpdate(status);
+    EventArena arena;
+
+    auto status = arena.create<ParkingSpaceStatus>();
+
+    status->set_spaceid(spaceID);
+    status->set_spacesection(prevState.getSection());
+    status->set_spacestate(occupied ? SpaceStates::OCCUPIED : SpaceStates::FREE);
+
+    this->notifications->publishParkingSpaceUpdate(*status);
 
     if (occupied) {
-        std::cout << "sending license plate read request" << std::endl;
+        LOG_DEBUG("Sending license plate read request", {"space", spaceID});
 
         PlateReadRequest req;
 
         req.set_spaceid(spaceID);
 
-        this->pendingIncomingPlates.insert({spaceID, std::string(space->getOccupant())});
+        {
+            std::unique_lock<std::mutex> acqLock(this->platesLock);
+
+            this->pendingIncomingPlates.insert(
+                    {spaceID, {std::string(prevState.getOccupant()), std::chrono::steady_clock::now()}});
+        }
 
         auto sent = this->notifications->sendPlateReadRequest(req);
 
         if (sent->size() <= 0) {
+            {
+                std::unique_lock<std::mutex> acqLock(this->platesLock);
+
+                auto pending = this->pendingIncomingPlates.find(spaceID);
+
+                //There's no round trip to measure
+                if (pending != this->pendingIncomingPlates.end()) {
+                    pending->second.requested = std::chrono::steady_clock::time_point();
+                }
+            }
+
             receiveLicensePlate(spaceID, "");
         } else {
             for (const auto &sub : *sent) {
@@ -109,7 +258,7 @@ void ParkingServer::receiveParkingSpaceNotification(int spaceID, bool occupied)
         }
     }
 
-    if (space->getState() == RESERVED && occupied) {
+    if (prevState.getState() == RESERVED && occupied) {
         ReserveStatus resStatus;
 
         resStatus.set_spaceid(spaceID);
@@ -126,13 +275,27 @@ void ParkingServer::receiveParkingSpaceNotification(int spaceID, bool occupied)
 
 void ParkingServer::receiveLicensePlate(const int &spaceID, const std::string &plate) {
 
-    auto node = this->pendingIncomingPlates.find(spaceID);
+    std::string previousOccupant;
+
+    {
+        std::unique_lock<std::mutex> acqLock(this->platesLock);
+
+        auto node = this->pendingIncomingPlates.find(spaceID);
+
+        if (node != this->pendingIncomingPlates.end()) {
+            if (node->second.requested != std::chrono::steady_clock::time_point()) {
+                plateReadLatency.recordSince(node->second.requested);
+            }
+
+            previousOccupant = std::move(node->second.previousOccupant);
 
-    this->pendingIncomingPlates.erase(node);
+            this->pendingIncomingPlates.erase(node);
+        }
+    }
 
     if (this->db->updateSpacePlate(spaceID, plate)) {
 
-        if ((node->second) == plate) {
+        if (previousOccupant == plate) {
 
             ReserveStatus resStatus;
 
@@ -160,6 +323,16 @@ void ParkingServer::receiveLicensePlate(const int &spaceID, const std::string &p
             this->notifications->publishReservationUpdate(cancelled);
             this->notifications->endReservationStreamsFor(cancelled);
 
+            EventArena arena;
+
+            auto freed = arena.create<ParkingSpaceStatus>();
+
+            freed->set_spaceid(reserve->getSpaceId());
+            freed->set_spacesection(reserve->getSection());
+            freed->set_spacestate(SpaceStates::FREE);
+
+            this->notifications->publishParkingSpaceUpdate(*freed);
+
             this->db->updateSpacePlate(spaceID, plate);
 
             this->connection->notifyArduino(reserve->getSpaceId(), false);
@@ -177,37 +350,52 @@ void ParkingServer::receiveLicensePlate(const int &spaceID, const std::string &p
 
 void ParkingServer::receiveTemperatureUpdate(int parkingSpace, int temperature) {
 
-    std::cout << "FIRE ALARM TEST " << std::endl;
+    std::unique_lock<std::mutex> sensorsLock(this->sensorLock);
+
+    publishTemperature(parkingSpace, temperature);
+}
+
+void ParkingServer::publishTemperature(int parkingSpace, int temperature) {
+
+    LOG_DEBUG("Temperature update", {"space", parkingSpace}, {"temperature", temperature});
+
     if (temperature > TEMP_LIMIT) {
 
         auto optState = this->db->getStateForSpace(parkingSpace);
 
-        std::cout << "FIRE ALARM " << std::endl;
+        LOG_WARN("Fire alarm", {"space", parkingSpace}, {"temperature", temperature});
+
+        EventArena arena;
 
-        ParkingSpaceStatus status;
+        auto status = arena.create<ParkingSpaceStatus>();
 
         if (optState) {
-            status.set_spacesection((*optState).getSection());
+            status->set_spacesection((*optState).getSection());
+            //The alarm doesn't change the state of the space, the streams that keep the latest status need it
+            status->set_spacestate((*optState).getState());
         }
 
-        status.set_spaceid(parkingSpace);
+        status->set_spaceid(parkingSpace);
 
-        status.set_firealarm(true);
+        status->set_firealarm(true);
 
-        this->notifications->publishParkingSpaceUpdate(status);
+        this->notifications->publishParkingSpaceUpdate(*status);
     }
 
 }
 
-ParkingServer::ParkingServer(std::shared_ptr<Database> db, std::shared_ptr<ArduinoConnection> conn) :
+ParkingServer::ParkingServer(std::shared_ptr<Database> db, std::shared_ptr<ArduinoConnection> conn,
+                             unsigned notificationQueues) :
         connection(conn),
         db(db),
         pendingIncomingPlates(),
+        reservationTimers(std::make_shared<ReservationTimers>(time(nullptr))),
         notifications(
-                std::make_shared<ParkingNotificationsImpl>(this)),
+                std::make_shared<ParkingNotificationsImpl>(this, notificationQueues)),
         spaces(std::make_shared<ParkingSpacesImpl>(db,
                                                    notifications,
-                                                   conn)) {
+                                                   conn,
+                                                   reservationTimers)) {
 
     grpc::ServerBuilder serverBuilder;
 
@@ -230,15 +418,22 @@ ParkingServer::ParkingServer(std::shared_ptr<Database> db, std::shared_ptr<Ardui
     serverBuilder.AddListeningPort(SERVER_IP,
             /*grpc::SslServerCredentials(ssl_opts)*/ grpc::InsecureServerCredentials());
 
-    serverBuilder.RegisterService(spaces.get());
+    spaces->registerService(serverBuilder);
 
     notifications->registerService(serverBuilder);
 
+    //The counts have to be there before the first call asks for them
+    this->sectionCounters.load(*this->db->fetchAllSpaceStates());
+
     server = serverBuilder.BuildAndStart();
 
     startNotifications();
 
+    startSpaces();
+
+    loadReservationTimers();
+
     startExpirations();
 
-    std::cout << "Server listening on IP: " << SERVER_IP << std::endl;
+    LOG_INFO("Server listening", {"address", SERVER_IP});
 }
@@ -3,41 +3,114 @@
 
 #include "parkingspacesimpl.h"
 #include "parkingnotifications.h"
+#include "reservationtimers.h"
+#include "sectioncounters.h"
+#include <chrono>
 #include <map>
+#include <mutex>
 #include <thread>
 
 #define SERVER_IP "0.0.0.0:50051"
 
+/**
+ * The section that spaces we have never seen before are inserted in
+ */
+#define DEFAULT_SECTION "A"
+
 class ArduinoConnection;
 
 class ParkingServer {
 
 private:
+    std::shared_ptr<ReservationTimers> reservationTimers;
     std::shared_ptr<ParkingNotificationsImpl> notifications;
     std::shared_ptr<ParkingSpacesImpl> spaces;
     std::shared_ptr<Database> db;
     std::shared_ptr<ArduinoConnection> connection;
 
-    std::thread notifThread, expirationThread;
+    std::vector<std::thread> notifThreads, spacesThreads;
+
+    std::thread expirationThread;
+
+    struct PendingPlate {
+        /**
+         * The occupant of the space before the car whose plate is being read
+         */
+        std::string previousOccupant;
+
+        /**
+         * When the plate was requested from the readers, empty when there were none
+         */
+        std::chrono::steady_clock::time_point requested;
+    };
 
-    std::map<int, std::string> pendingIncomingPlates;
+    /**
+     * Written by the sensor events and read by the plate readers, which are served from any of the notification queues
+     */
+    std::map<int, PendingPlate> pendingIncomingPlates;
+
+    std::mutex platesLock;
+
+    /**
+     * The sensor events come from the Firebase thread and the debouncer thread, they're applied one at a time
+     */
+    std::mutex sensorLock;
+
+    SectionCounters sectionCounters;
 
     std::unique_ptr<grpc::Server> server;
 
 public:
-    ParkingServer(std::shared_ptr<Database> db, std::shared_ptr<ArduinoConnection> connection);
+    /**
+     * @param notificationQueues The number of completion queues (And threads) serving the notification streams,
+     * 0 for one per core
+     */
+    ParkingServer(std::shared_ptr<Database> db, std::shared_ptr<ArduinoConnection> connection,
+                  unsigned notificationQueues = DEFAULT_NOTIFICATION_QUEUES);
 
     void receiveParkingSpaceNotification(int parkingSpace, bool occupied);
 
+    /**
+     * Receive the state of many spaces at once, the changed spaces are written to the database in a single batch
+     * @param readings
+     */
+    void receiveParkingSpaceSnapshot(const std::vector<SpaceReading> &readings);
+
     void receiveLicensePlate(const int &spaceID, const std::string &plate);
 
     void receiveTemperatureUpdate(int parkingSpace, int temperature);
 
+    /**
+     * Cancel a reservation whose timer has run out, if the space is still reserved by it
+     * @param spaceID
+     */
+    void expireReservation(int spaceID);
+
     void wait();
 
 private:
+    /**
+     * Notify the subscribers of a change in the occupation of a space that has already been written to the database
+     * @param spaceID
+     * @param occupied
+     * @param prevState The state of the space before the change
+     */
+    void publishSpaceOccupation(int spaceID, bool occupied, const SpaceState &prevState);
+
+    /**
+     * Raise the fire alarm of a space if it's too hot. The sensor lock must be held
+     */
+    void publishTemperature(int parkingSpace, int temperature);
+
     void startNotifications();
 
+    void startSpaces();
+
+    /**
+     * Schedule the timers of the reservations that are already in the database
+     */
+    void loadReservationTimers();
+
     void startExpirations();
 
 public:
@@ -49,6 +122,10 @@ public:
         return notifications.get();
     }
 
+    ReservationTimers *getReservationTimers() const {
+        return reservationTimers.get();
+    }
+
     ParkingSpacesImpl *getSpaces() const {
         return spaces.get();
     }
@@ -57,6 +134,13 @@ public:
         return this->db.get();
     }
 
+    /**
+     * The live counts of every section, kept up to date by the published changes
+     */
+    SectionCounters *getSectionCounters() {
+        return &this->sectionCounters;
+    }
+
 };
 
 #endif //RASPBERRY_SERVER_H
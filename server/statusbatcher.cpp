@@ -0,0 +1,69 @@
+#include "statusbatcher.h"
+
+StatusBatcher::StatusBatcher(Flush flush, int windowMs) : flush(std::move(flush)),
+                                                          windowMs(windowMs) {
+    this->flushThread.start([this](std::unique_lock<std::mutex> &waitLock) { flushLoop(waitLock); });
+}
+
+StatusBatcher::~StatusBatcher() {
+    this->flushThread.stop();
+}
+
+void StatusBatcher::add(const parkingspaces::ParkingSpaceStatus &status) {
+
+    bool first;
+
+    {
+        auto acqLock = this->flushThread.acquire();
+
+        first = this->pending.spaces_size() == 0;
+
+        if (status.firealarm()) {
+            *this->pending.add_spaces() = status;
+
+            //The updates of the space after the alarm go after it
+            this->positions.erase(status.spaceid());
+        } else {
+            auto position = this->positions.find(status.spaceid());
+
+            if (position != this->positions.end()) {
+                *this->pending.mutable_spaces(position->second) = status;
+            } else {
+                this->positions[status.spaceid()] = this->pending.spaces_size();
+
+                *this->pending.add_spaces() = status;
+            }
+        }
+    }
+
+    //Only the first update of a batch has to wake up the flush thread, the rest are picked up with it
+    if (first) {
+        this->flushThread.wakeOne();
+    }
+}
+
+void StatusBatcher::flushLoop(std::unique_lock<std::mutex> &waitLock) {
+
+    while (true) {
+
+        this->flushThread.waitForWork(waitLock, [this]() { return this->pending.spaces_size() > 0; });
+
+        if (this->pending.spaces_size() == 0) break;
+
+        //The window starts with the first update of the batch, the ones that come in it are merged into the batch
+        //instead of waking the thread up (When stopping, what is pending is flushed right away)
+        this->flushThread.sleep(waitLock, std::chrono::milliseconds(this->windowMs));
+
+        this->flushing.Swap(&this->pending);
+
+        this->positions.clear();
+
+        waitLock.unlock();
+
+        this->flush(this->flushing);
+
+        this->flushing.Clear();
+
+        waitLock.lock();
+    }
+}
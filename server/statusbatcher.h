@@ -0,0 +1,61 @@
+#ifndef RASPBERRY_STATUSBATCHER_H
+#define RASPBERRY_STATUSBATCHER_H
+
+#include "parkingext.pb.h"
+#include "callpool.h"
+#include "../util/backgroundloop.h"
+#include <functional>
+#include <unordered_map>
+
+/**
+ * How long the updates are gathered for, from the first update of a batch until it's sent
+ */
+#define STATUS_BATCH_WINDOW_MS 50
+
+/**
+ * Gathers the parking space updates into batches, so the batched streams get one message per window instead of one
+ * for every update (Which, when a snapshot is applied, can be thousands of them at once).
+ *
+ * A batch keeps the latest update of every space, in the place of the first one, and every fire alarm (The updates of
+ * a space that follow an alarm are kept after it). The batches are flushed from a thread of their own, one at a time
+ * and in order.
+ */
+class StatusBatcher {
+
+public:
+    typedef std::function<void(const parkingext::SpaceStatusBatch &)> Flush;
+
+private:
+    Flush flush;
+
+    int windowMs;
+
+    /**
+     * The batch being gathered and the one being flushed, which are swapped. A cleared batch keeps its messages (And
+     * their strings) to be reused by the next one, so once they have grown to the size of a window's updates batching
+     * doesn't allocate
+     */
+    parkingext::SpaceStatusBatch pending, flushing;
+
+    /**
+     * Where the update of each space is in the pending batch
+     */
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, int>>> positions;
+
+    BackgroundLoop flushThread;
+
+public:
+    explicit StatusBatcher(Flush flush, int windowMs = STATUS_BATCH_WINDOW_MS);
+
+    /**
+     * Flushes what is pending
+     */
+    ~StatusBatcher();
+
+    void add(const parkingspaces::ParkingSpaceStatus &status);
+
+private:
+    void flushLoop(std::unique_lock<std::mutex> &waitLock);
+};
+
+#endif //RASPBERRY_STATUSBATCHER_H
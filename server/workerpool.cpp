@@ -0,0 +1,40 @@
+#include "workerpool.h"
+
+WorkerPool::WorkerPool(unsigned threads) {
+    this->workers.start([this](std::unique_lock<std::mutex> &waitLock) { workLoop(waitLock); }, threads);
+}
+
+WorkerPool::~WorkerPool() {
+    this->workers.stop();
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+
+    {
+        auto acqLock = this->workers.acquire();
+
+        this->tasks.push(std::move(task));
+    }
+
+    this->workers.wakeOne();
+}
+
+void WorkerPool::workLoop(std::unique_lock<std::mutex> &waitLock) {
+
+    while (true) {
+
+        this->workers.waitForWork(waitLock, [this]() { return !this->tasks.empty(); });
+
+        if (this->tasks.empty()) break;
+
+        auto task = std::move(this->tasks.front());
+
+        this->tasks.pop();
+
+        waitLock.unlock();
+
+        task();
+
+        waitLock.lock();
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef RASPBERRY_WORKERPOOL_H
+#define RASPBERRY_WORKERPOOL_H
+
+#include "../util/backgroundloop.h"
+#include <functional>
+#include <queue>
+
+#define DEFAULT_WORKER_THREADS 4
+
+/**
+ * A fixed number of threads that run the slow parts of the requests (Database writes, Firebase calls), so the
+ * completion queue threads never block on them and the thread count doesn't grow with the requests in flight
+ */
+class WorkerPool {
+
+private:
+    std::queue<std::function<void()>> tasks;
+
+    BackgroundLoop workers;
+
+public:
+    explicit WorkerPool(unsigned threads = DEFAULT_WORKER_THREADS);
+
+    /**
+     * Waits for the tasks that were already submitted
+     */
+    ~WorkerPool();
+
+    void submit(std::function<void()> task);
+
+private:
+    void workLoop(std::unique_lock<std::mutex> &waitLock);
+};
+
+#endif //RASPBERRY_WORKERPOOL_H
@@ -1,123 +1,465 @@
 #include "parkingspaces.grpc.pb.h"
+#include "../metrics/metrics.h"
 
 #include <grpcpp/channel.h>
 #include <grpcpp/client_context.h>
 #include <grpcpp/create_channel.h>
 #include <grpcpp/security/credentials.h>
+#include <grpcpp/support/channel_arguments.h>
 #include "grpc/grpc.h"
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #define CERT_STORAGE "./ssl/"
 #define PRIV_KEY "service.key"
 #define CERT_FILE "service.pem"
 
+#define DEFAULT_TARGET "localhost:50051"
 
-class Client {
+#define DEFAULT_DURATION_S 30
+#define DEFAULT_SUBSCRIBERS 50
+#define DEFAULT_RESERVATIONS_PER_SECOND 20
+#define DEFAULT_RESERVATION_THREADS 4
+#define DEFAULT_PLATE_READERS 0
+
+/**
+ * How long a reservation or cancel can take before it counts as an error
+ */
+#define RPC_DEADLINE_MS 5000
+
+struct LoadConfig {
+    std::string target = DEFAULT_TARGET;
+
+    int durationS = DEFAULT_DURATION_S;
+
+    /**
+     * The clients subscribed to the parking states, every one on a connection (And a thread) of its own
+     */
+    int subscribers = DEFAULT_SUBSCRIBERS;
+
+    double reservationsPerSecond = DEFAULT_RESERVATIONS_PER_SECOND;
+
+    int reservationThreads = DEFAULT_RESERVATION_THREADS;
+
+    /**
+     * The fake plate readers, registered for the spaces of the lot in order
+     */
+    int plateReaders = DEFAULT_PLATE_READERS;
+
+    /**
+     * How long a plate reader takes to answer a read request
+     */
+    int plateReplyDelayMs = 0;
+};
+
+/**
+ * Drives a running server with subscribers, reservation attempts and plate readers at the same time and reports the
+ * latency and throughput of each.
+ *
+ * The reservations are sent open loop: every attempt has its time in the schedule and its latency is counted from
+ * there, so a slow server shows up as latency instead of as fewer requests (Coordinated omission).
+ * Every successful reservation is cancelled right after, so the spaces stay free for the next attempts.
+ *
+ * The delivery latency is from sending a reservation to a subscriber receiving the space as reserved
+ */
+class LoadGenerator {
+
+private:
+    LoadConfig config;
+
+    std::vector<int> spaces;
+
+    std::unordered_map<int, size_t> spaceIndexes;
+
+    /**
+     * When the last reservation of every space was sent, in steady clock ns
+     */
+    std::unique_ptr<std::atomic<int64_t>[]> reservedAt;
+
+    std::atomic_bool running;
+
+    std::mutex lock;
+
+    /**
+     * The streams that are still open, cancelled when the run is over
+     */
+    std::vector<grpc::ClientContext *> streams;
+
+    Histogram reserveLatency, cancelLatency, deliveryLatency;
+
+    Counter reservations, rejectedReservations, failedCalls, statusesReceived, subscribersConnected,
+            plateRequestsAnswered;
 
 public:
-    Client(std::shared_ptr<grpc::Channel> channel) : stub_(parkingspaces::ParkingNotifications::NewStub(channel)),
-                                                     stubp_(parkingspaces::ParkingSpaces::NewStub(channel)) {}
+    explicit LoadGenerator(LoadConfig config) : config(std::move(config)), running(false) {}
+
+    int run() {
+
+        if (!fetchLot()) return 1;
+
+        std::cout << "Running against " << config.target << " for " << config.durationS << " s: "
+                  << config.subscribers << " subscribers, " << config.reservationsPerSecond
+                  << " reservations/s, " << config.plateReaders << " plate readers, " << spaces.size()
+                  << " spaces" << std::endl;
+
+        running = true;
+
+        std::vector<std::thread> threads;
 
-    void subToParkingSpaces() {
-        grpc::ClientContext context, context2;
+        for (int i = 0; i < config.subscribers; i++) {
+            threads.emplace_back(&LoadGenerator::subscriber, this);
+        }
+
+        for (int i = 0; i < config.plateReaders && !spaces.empty(); i++) {
+            threads.emplace_back(&LoadGenerator::plateReader, this, spaces[i % spaces.size()]);
+        }
+
+        if (config.reservationsPerSecond > 0 && !spaces.empty()) {
+            for (int i = 0; i < config.reservationThreads; i++) {
+                threads.emplace_back(&LoadGenerator::reserver, this, i);
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
 
-        parkingspaces::ParkingSpacesRq rq2;
+        std::this_thread::sleep_for(std::chrono::seconds(config.durationS));
 
-        auto result = stubp_->fetchAllParkingStates(&context2, rq2);
+        running = false;
 
-        parkingspaces::ParkingSpaceStatus status2;
+        {
+            std::unique_lock<std::mutex> acqLock(this->lock);
 
-        while (result->Read(&status2)) {
-            std::cout << "Read message2 " << std::endl;
+            for (auto *stream : this->streams) {
+                stream->TryCancel();
+            }
+        }
 
-            std::cout << status2.spaceid() << " " << status2.spacesection() << " " << status2.spacestate() << std::endl;
+        for (auto &thread : threads) {
+            thread.join();
         }
 
-        parkingspaces::ParkingSpacesRq rq;
-        auto reader = stub_->subscribeToParkingStates(&context, rq);
+        report(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        return 0;
+    }
+
+private:
+    static std::shared_ptr<grpc::Channel> connect(const std::string &target) {
+
+        grpc::ChannelArguments args;
+
+        //Without this the channels to the same target share one connection, every client should have its own
+        args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+        return grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), args);
+    }
+
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * The spaces of the lot are the ones that get reserved and read
+     */
+    bool fetchLot() {
+
+        auto stub = parkingspaces::ParkingSpaces::NewStub(connect(config.target));
+
+        grpc::ClientContext context;
+
+        auto reader = stub->fetchAllParkingStates(&context, parkingspaces::ParkingSpacesRq());
 
         parkingspaces::ParkingSpaceStatus status;
 
         while (reader->Read(&status)) {
-            std::cout << "Read message " << std::endl;
+            spaceIndexes.emplace(status.spaceid(), spaces.size());
+            spaces.push_back(status.spaceid());
+        }
+
+        auto result = reader->Finish();
 
-            std::cout << status.spaceid() << " " << status.spacesection() << " " << status.spacestate() << std::endl;
+        if (!result.ok()) {
+            std::cerr << "Failed to fetch the lot from " << config.target << ": " << result.error_message()
+                      << std::endl;
+
+            return false;
+        }
+
+        reservedAt = std::make_unique<std::atomic<int64_t>[]>(spaces.size());
+
+        for (size_t i = 0; i < spaces.size(); i++) {
+            reservedAt[i].store(0);
         }
 
-        reader->Finish();
+        return true;
     }
 
-    void testReserve() {
-        grpc::ClientContext context;
+    /**
+     * Keep a stream open to be cancelled at the end, if the run is already over it's not started
+     */
+    bool openStream(grpc::ClientContext *context) {
+        std::unique_lock<std::mutex> acqLock(this->lock);
+
+        if (!running) return false;
+
+        this->streams.push_back(context);
+
+        return true;
+    }
+
+    void closeStream(grpc::ClientContext *context) {
+        std::unique_lock<std::mutex> acqLock(this->lock);
+
+        this->streams.erase(std::remove(this->streams.begin(), this->streams.end(), context), this->streams.end());
+    }
 
-        parkingspaces::ParkingSpaceReservation reservation;
+    void subscriber() {
 
-        reservation.set_spaceid(1);
-        reservation.set_licenceplate("13-HX-23");
+        auto stub = parkingspaces::ParkingNotifications::NewStub(connect(config.target));
 
-        parkingspaces::ReservationResponse reservationResponse;
+        grpc::ClientContext context;
 
-        stubp_->attemptToReserveSpace(&context, reservation, &reservationResponse);
+        if (!openStream(&context)) return;
 
-        std::cout << reservationResponse.spaceid() << " has responded with " << reservationResponse.response()
-                  << std::endl;
+        auto reader = stub->subscribeToParkingStates(&context, parkingspaces::ParkingSpacesRq());
 
-        grpc::ClientContext context2;
+        subscribersConnected.increment();
 
-        parkingspaces::ParkingSpaceReservation reservation2;
+        parkingspaces::ParkingSpaceStatus status;
 
-        reservation2.set_spaceid(1);
-        reservation2.set_licenceplate("13-HX-24");
+        while (reader->Read(&status)) {
+            statusesReceived.increment();
 
-        parkingspaces::ReservationResponse reservationResponse2;
+            if (status.spacestate() != parkingspaces::RESERVED) continue;
 
-        stubp_->attemptToReserveSpace(&context2, reservation2, &reservationResponse2);
+            auto space = spaceIndexes.find(status.spaceid());
 
-        std::cout << reservationResponse.spaceid() << " has responded with " << reservationResponse2.response()
-                  << std::endl;
+            if (space == spaceIndexes.end()) continue;
 
-        grpc::ClientContext context3;
+            int64_t sent = reservedAt[space->second].load(std::memory_order_relaxed);
 
-        parkingspaces::ReservationCancelResponse cancelResponse;
+            if (sent > 0) deliveryLatency.record(nowNs() - sent);
+        }
 
-        //stubp_->cancelSpaceReservation(&context3, cancelResponse, &cancelResponse);
+        auto result = reader->Finish();
 
-        std::cout << "Cancelling response:" << cancelResponse.cancelstate() << std::endl;
+        if (!result.ok() && result.error_code() != grpc::StatusCode::CANCELLED) {
+            failedCalls.increment();
+        }
+
+        closeStream(&context);
     }
 
-    void testPlateReader() {
+    void plateReader(int spaceID) {
 
-        using namespace parkingspaces;
+        auto stub = parkingspaces::ParkingNotifications::NewStub(connect(config.target));
 
         grpc::ClientContext context;
 
-        auto writers = stub_->registerPlateReader(
-                &context);
+        if (!openStream(&context)) return;
+
+        auto stream = stub->registerPlateReader(&context);
+
+        parkingspaces::PlateReaderResult result;
+
+        result.set_spaceid(spaceID);
+        result.set_registration(true);
+
+        stream->Write(result);
+
+        parkingspaces::PlateReadRequest request;
+
+        uint64_t reads = 0;
 
-        PlateReaderResult result;
+        while (stream->Read(&request)) {
 
-        result.set_spaceid(1);
+            if (config.plateReplyDelayMs > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(config.plateReplyDelayMs));
+            }
 
-        writers->Write(result);
+            result.set_spaceid(request.spaceid());
+            result.set_registration(false);
+            result.set_plate("PR-" + std::to_string(spaceID) + "-" + std::to_string(reads++));
 
-        PlateReadRequest req;
+            if (!stream->Write(result)) break;
 
-        writers->Read(&req);
+            plateRequestsAnswered.increment();
+        }
+
+        stream->Finish();
 
-        std::cout << "Read " << req.spaceid() << std::endl;
+        closeStream(&context);
     }
 
-private:
-    std::unique_ptr<parkingspaces::ParkingNotifications::Stub> stub_;
-    std::unique_ptr<parkingspaces::ParkingSpaces::Stub> stubp_;
+    void reserver(int worker) {
+
+        auto stub = parkingspaces::ParkingSpaces::NewStub(connect(config.target));
+
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(config.reservationThreads / config.reservationsPerSecond));
+
+        std::mt19937 random(worker);
+
+        std::uniform_int_distribution<size_t> pickSpace(0, spaces.size() - 1);
+
+        auto next = std::chrono::steady_clock::now() + interval * worker / config.reservationThreads;
+
+        for (uint64_t attempt = 0; running; attempt++) {
+
+            std::this_thread::sleep_until(next);
+
+            auto scheduled = next;
+
+            next += interval;
+
+            size_t space = pickSpace(random);
+
+            std::string plate = "LG-" + std::to_string(worker) + "-" + std::to_string(attempt);
+
+            parkingspaces::ParkingSpaceReservation reservation;
+
+            reservation.set_spaceid(spaces[space]);
+            reservation.set_licenceplate(plate);
+
+            parkingspaces::ReservationResponse response;
+
+            grpc::ClientContext context;
+
+            context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(RPC_DEADLINE_MS));
+
+            reservedAt[space].store(nowNs(), std::memory_order_relaxed);
+
+            auto status = stub->attemptToReserveSpace(&context, reservation, &response);
+
+            reserveLatency.recordSince(scheduled);
+
+            if (!status.ok()) {
+                failedCalls.increment();
+
+                continue;
+            }
+
+            if (response.response() != parkingspaces::SUCCESSFUL) {
+                rejectedReservations.increment();
+
+                continue;
+            }
+
+            reservations.increment();
+
+            parkingspaces::ReservationCancelRequest cancel;
+
+            cancel.set_licenseplate(plate);
+
+            parkingspaces::ReservationCancelResponse cancelResponse;
+
+            grpc::ClientContext cancelContext;
+
+            cancelContext.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(RPC_DEADLINE_MS));
+
+            auto cancelStart = std::chrono::steady_clock::now();
+
+            if (!stub->cancelSpaceReservation(&cancelContext, cancel, &cancelResponse).ok()) {
+                failedCalls.increment();
+            }
+
+            cancelLatency.recordSince(cancelStart);
+        }
+    }
+
+    static void printLatency(const char *name, const Histogram &histogram, double elapsedS) {
+
+        uint64_t count = histogram.getCount();
+
+        char line[160];
+
+        if (count == 0) {
+            snprintf(line, sizeof(line), "%-12s %10s", name, "-");
+        } else {
+            snprintf(line, sizeof(line), "%-12s %10llu %10.1f/s  p50 %8.3f ms  p99 %8.3f ms  p999 %8.3f ms", name,
+                     (unsigned long long) count, count / elapsedS, histogram.quantile(0.5) / 1e6,
+                     histogram.quantile(0.99) / 1e6, histogram.quantile(0.999) / 1e6);
+        }
+
+        std::cout << line << std::endl;
+    }
+
+    void report(double elapsedS) {
+
+        std::cout << std::endl;
+
+        printLatency("reserve", reserveLatency, elapsedS);
+        printLatency("cancel", cancelLatency, elapsedS);
+        printLatency("delivery", deliveryLatency, elapsedS);
+
+        std::cout << std::endl
+                  << "Reservations: " << reservations.get() << " successful, " << rejectedReservations.get()
+                  << " rejected" << std::endl
+                  << "Subscribers: " << subscribersConnected.get() << " connected, " << statusesReceived.get()
+                  << " statuses received (" << statusesReceived.get() / elapsedS << "/s)" << std::endl
+                  << "Plate readers: " << plateRequestsAnswered.get() << " requests answered" << std::endl
+                  << "Failed calls: " << failedCalls.get() << std::endl;
+    }
 };
 
+static void usage(const char *program) {
+    std::cerr << "Usage: " << program << " [--target host:port] [--duration s] [--subscribers n]"
+                                         " [--reservations-per-second n] [--reservation-threads n]"
+                                         " [--plate-readers n] [--plate-delay-ms n]" << std::endl;
+}
+
+/**
+ * A load generator for the server
+ *
+ * Usage: RaspberryTest [--target host:port] [--duration s] [--subscribers n] [--reservations-per-second n]
+ *                      [--reservation-threads n] [--plate-readers n] [--plate-delay-ms n]
+ */
 int main(int argc, char **argv) {
 
-    auto channel = grpc::CreateChannel("localhost:50051", grpc::InsecureChannelCredentials());
+    LoadConfig config;
+
+    for (int i = 1; i < argc; i++) {
+
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+
+            return 1;
+        }
+
+        const char *option = argv[i], *value = argv[++i];
+
+        if (strcmp(option, "--target") == 0) {
+            config.target = value;
+        } else if (strcmp(option, "--duration") == 0) {
+            config.durationS = atoi(value);
+        } else if (strcmp(option, "--subscribers") == 0) {
+            config.subscribers = atoi(value);
+        } else if (strcmp(option, "--reservations-per-second") == 0) {
+            config.reservationsPerSecond = atof(value);
+        } else if (strcmp(option, "--reservation-threads") == 0) {
+            config.reservationThreads = std::max(1, atoi(value));
+        } else if (strcmp(option, "--plate-readers") == 0) {
+            config.plateReaders = atoi(value);
+        } else if (strcmp(option, "--plate-delay-ms") == 0) {
+            config.plateReplyDelayMs = atoi(value);
+        } else {
+            usage(argv[0]);
+
+            return 1;
+        }
+    }
 
-    Client cl(channel);
+    LoadGenerator generator(config);
 
-    cl.testPlateReader();
-}
\ No newline at end of file
+    return generator.run();
+}
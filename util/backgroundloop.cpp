@@ -0,0 +1,39 @@
+#include "backgroundloop.h"
+
+BackgroundLoop::BackgroundLoop() : running(false) {}
+
+BackgroundLoop::~BackgroundLoop() {
+    stop();
+}
+
+void BackgroundLoop::start(const Loop &loop, unsigned threadCount) {
+
+    this->running = true;
+
+    for (unsigned i = 0; i < threadCount; i++) {
+        this->threads.emplace_back([this, loop]() {
+            std::unique_lock<std::mutex> waitLock(this->lock);
+
+            loop(waitLock);
+        });
+    }
+}
+
+void BackgroundLoop::stop() {
+
+    {
+        std::unique_lock<std::mutex> stopLock(this->lock);
+
+        this->running = false;
+    }
+
+    this->condition.notify_all();
+
+    for (auto &thread : this->threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    this->threads.clear();
+}
@@ -0,0 +1,107 @@
+#ifndef RASPBERRY_BACKGROUNDLOOP_H
+#define RASPBERRY_BACKGROUNDLOOP_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * The threads of a class that works in the background, with the lock that guards the state they share with it and the
+ * condition they wait on.
+ *
+ * Each thread runs the loop with the lock held, the loop waits with the methods below, which also return once the
+ * threads are being stopped, and returns when there is nothing left for it to do.
+ */
+class BackgroundLoop {
+
+public:
+    typedef std::function<void(std::unique_lock<std::mutex> &waitLock)> Loop;
+
+private:
+    bool running;
+
+    std::mutex lock;
+
+    std::condition_variable condition;
+
+    std::vector<std::thread> threads;
+
+public:
+    BackgroundLoop();
+
+    /**
+     * Stops the threads if the owner didn't
+     */
+    ~BackgroundLoop();
+
+    void start(const Loop &loop, unsigned threadCount = 1);
+
+    /**
+     * Wakes the threads up to return from their loops and waits for them, the owner must call it before destroying
+     * anything the loop uses
+     */
+    void stop();
+
+    /**
+     * Take the lock shared with the threads
+     */
+    std::unique_lock<std::mutex> acquire() {
+        return std::unique_lock<std::mutex>(this->lock);
+    }
+
+    /**
+     * Whether the threads are still meant to run, the lock must be held
+     */
+    bool isRunning() const {
+        return running;
+    }
+
+    void wakeOne() {
+        this->condition.notify_one();
+    }
+
+    void wakeAll() {
+        this->condition.notify_all();
+    }
+
+    /**
+     * Wait until there is work, or the threads are being stopped
+     */
+    template<typename Predicate>
+    void waitForWork(std::unique_lock<std::mutex> &waitLock, Predicate hasWork) {
+        this->condition.wait(waitLock, [this, &hasWork]() { return !this->running || hasWork(); });
+    }
+
+    /**
+     * Wait for as long as the duration, or until the threads are being stopped
+     * @return Whether the threads are still running
+     */
+    template<typename Rep, typename Period>
+    bool sleep(std::unique_lock<std::mutex> &waitLock, const std::chrono::duration<Rep, Period> &duration) {
+        return !this->condition.wait_for(waitLock, duration, [this]() { return !this->running; });
+    }
+
+    /**
+     * Wait until the time point, a wake up or the threads being stopped, whichever comes first
+     */
+    template<typename Clock, typename Duration>
+    void waitUntil(std::unique_lock<std::mutex> &waitLock, const std::chrono::time_point<Clock, Duration> &time) {
+        if (this->running) {
+            this->condition.wait_until(waitLock, time);
+        }
+    }
+
+    /**
+     * Wait for a wake up, or the threads being stopped
+     */
+    void wait(std::unique_lock<std::mutex> &waitLock) {
+        if (this->running) {
+            this->condition.wait(waitLock);
+        }
+    }
+};
+
+#endif //RASPBERRY_BACKGROUNDLOOP_H